@@ -0,0 +1,140 @@
+// End-to-end benchmark of driver calls under different mount options.
+// Build with `make networkfs_bench_rpc` in the build directory, then run as
+// root with the module loaded and the server started:
+//
+//   sudo ./networkfs_bench_rpc "" "nonodelay" "sndbuf=4194304,rcvbuf=4194304"
+//
+// Every argument is a profile of mount options; the default one is used if
+// none are given. For each profile the bucket is mounted and measured with
+// small-op latency (open+read+close of a file and create+unlink of one, each
+// a server round trip) and read throughput from several threads.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../tests/lib/nfs.hpp"
+#include "../tests/lib/util.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t LATENCY_ITERATIONS = 2000;
+constexpr size_t THROUGHPUT_THREADS = 8;
+constexpr auto THROUGHPUT_DURATION = std::chrono::seconds(2);
+constexpr size_t FILE_SIZE = 512;
+
+static double micros(Clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+static void read_file(const fs::path& path) {
+  char buffer[FILE_SIZE];
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0 || read(fd, buffer, sizeof(buffer)) != FILE_SIZE) {
+    throw std::runtime_error("read of " + path.string() + " failed");
+  }
+  close(fd);
+}
+
+static void create_unlink(const fs::path& path) {
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("create of " + path.string() + " failed");
+  }
+  close(fd);
+  unlink(path.c_str());
+}
+
+template <typename F> static std::vector<double> measure(F op) {
+  std::vector<double> samples;
+  samples.reserve(LATENCY_ITERATIONS);
+  for (size_t i = 0; i < LATENCY_ITERATIONS; ++i) {
+    auto start = Clock::now();
+    op();
+    samples.push_back(micros(Clock::now() - start));
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples;
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+  return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+static double read_throughput(const std::vector<fs::path>& files) {
+  std::atomic<bool> stop = false;
+  std::atomic<size_t> ops = 0;
+  std::vector<std::thread> threads;
+
+  for (size_t t = 0; t < THROUGHPUT_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      size_t local = 0;
+      while (!stop) {
+        read_file(files[t % files.size()]);
+        ++local;
+      }
+      ops += local;
+    });
+  }
+  std::this_thread::sleep_for(THROUGHPUT_DURATION);
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return ops / std::chrono::duration<double>(THROUGHPUT_DURATION).count();
+}
+
+static void run_profile(const std::string& options) {
+  setenv("NETWORKFS_MOUNT_OPTIONS", options.c_str(), 1);
+  NfsBucket nfs;
+  nfs.initialize();
+
+  try {
+    std::vector<fs::path> files;
+    for (size_t t = 0; t < THROUGHPUT_THREADS; ++t) {
+      files.push_back(TEST_ROOT / ("bench" + std::to_string(t)));
+      std::ofstream(files.back()) << std::string(FILE_SIZE, 'x');
+    }
+
+    auto reads = measure([&] { read_file(files[0]); });
+    auto creates = measure([&] { create_unlink(TEST_ROOT / "bench-tmp"); });
+    double ops = read_throughput(files);
+
+    printf("%-40s %9.1f %9.1f %9.1f %9.1f %10.0f %8.2f\n",
+           options.empty() ? "(defaults)" : options.c_str(),
+           percentile(reads, 0.5), percentile(reads, 0.99),
+           percentile(creates, 0.5), percentile(creates, 0.99), ops,
+           ops * FILE_SIZE / (1 << 20));
+    fflush(stdout);
+  } catch (...) {
+    nfs.unmount(false);
+    throw;
+  }
+  nfs.unmount(true);
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> profiles(argv + 1, argv + argc);
+  if (profiles.empty()) {
+    profiles.push_back("");
+  }
+
+  printf("%-40s %9s %9s %9s %9s %10s %8s\n", "options", "read p50",
+         "read p99", "creat p50", "creat p99", "reads/s", "MiB/s");
+  printf("%-40s %9s %9s %9s %9s %10s %8s\n", "", "(us)", "(us)", "(us)",
+         "(us)", "", "");
+  for (const auto& options : profiles) {
+    run_profile(options);
+  }
+  return 0;
+}
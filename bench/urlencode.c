@@ -0,0 +1,98 @@
+// Userspace microbenchmark of the URL encoder used by the driver.
+// Build with `make networkfs_bench_urlencode` in the build directory.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "remote/urlencode.h"
+
+// Encoder used before networkfs_urlencode(), kept for comparison
+static void urlnencode_strcat(char *dst, const char *src, size_t len) {
+  dst[0] = 0;
+
+  for (size_t idx = 0; idx < len; ++idx) {
+    if (('0' <= src[idx] && src[idx] <= '9') ||
+        ('A' <= src[idx] && src[idx] <= 'Z') ||
+        ('a' <= src[idx] && src[idx] <= 'z')) {
+      strncat(dst, src + idx, 1);
+    } else {
+      sprintf(dst + strlen(dst), "%%%02X", (unsigned char)src[idx]);
+    }
+  }
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// File names and text: mostly letters and digits with some punctuation
+static void fill_text(char *buf, size_t len) {
+  static const char alphabet[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+      "abcdefghijklmnopqrstuvwxyz0123456789 ._-/";
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+  }
+}
+
+static void fill_binary(char *buf, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] = (char)rand();
+  }
+}
+
+static void run(const char *input_name, void (*fill)(char *, size_t),
+                size_t len) {
+  char *src = malloc(len);
+  char *dst_old = malloc(3 * len + 1);
+  char *dst_new = malloc(3 * len + 1);
+  fill(src, len);
+
+  urlnencode_strcat(dst_old, src, len);
+  size_t encoded = networkfs_urlencode(dst_new, src, len);
+  if (encoded != strlen(dst_old) || strcmp(dst_old, dst_new) != 0) {
+    fprintf(stderr, "mismatch on %s input of %zu bytes\n", input_name, len);
+    exit(1);
+  }
+
+  // keep total work of the quadratic encoder reasonable
+  size_t iterations_old = len <= 4096 ? 20000 : 3;
+  size_t iterations_new = len <= 4096 ? 200000 : 2000;
+
+  double start = now_ns();
+  for (size_t i = 0; i < iterations_old; ++i) {
+    urlnencode_strcat(dst_old, src, len);
+  }
+  double old_ns = (now_ns() - start) / iterations_old;
+
+  start = now_ns();
+  for (size_t i = 0; i < iterations_new; ++i) {
+    networkfs_urlencode(dst_new, src, len);
+    __asm__ volatile("" : : "r"(dst_new) : "memory");
+  }
+  double new_ns = (now_ns() - start) / iterations_new;
+
+  printf("%-6s %6zu B  strcat: %12.0f ns (%8.1f MB/s)  table: %10.0f ns "
+         "(%8.1f MB/s)  x%.1f\n",
+         input_name, len, old_ns, len / old_ns * 1e3, new_ns,
+         len / new_ns * 1e3, old_ns / new_ns);
+
+  free(src);
+  free(dst_old);
+  free(dst_new);
+}
+
+int main(void) {
+  srand(42);
+  const size_t sizes[] = {512, 64 * 1024};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    run("text", fill_text, sizes[i]);
+    run("binary", fill_binary, sizes[i]);
+  }
+  return 0;
+}
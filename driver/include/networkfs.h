@@ -1,10 +1,109 @@
 #ifndef NETWORKFS_NETWORKFS
 #define NETWORKFS_NETWORKFS
 
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/rwsem.h>
 #include <linux/stat.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+
+#include "remote/connection.h"
+#include "remote/rpc.h"
 
 #define NFS_MAXSZ 512
 #define NFS_PERM (S_IRWXU | S_IRWXG | S_IRWXO)
 #define NFS_ROOT 1000
 
+#define NFS_TIMEO_DEFAULT 300  // deciseconds
+#define NFS_TIMEO_MAX 6000
+#define NFS_RETRANS_DEFAULT 2
+#define NFS_RETRANS_MAX 10
+#define NFS_SOCKBUF_MAX (64 << 20)
+#define NFS_BUSY_POLL_MAX 10000  // microseconds
+#define NFS_NEGTTL_DEFAULT 3     // seconds
+#define NFS_NEGTTL_MAX 3600
+#define NFS_ACREGMIN_DEFAULT 3  // seconds
+#define NFS_ACREGMAX_DEFAULT 60
+#define NFS_ACDIRMIN_DEFAULT 30
+#define NFS_ACDIRMAX_DEFAULT 60
+#define NFS_ACTIMEO_MAX 3600
+#define NFS_DIR_CACHE_MAX 1024  // entries of a cached listing
+
+// Options given at mount time, kept in fs_context until the superblock exists
+struct networkfs_mount_options {
+  unsigned int pool_size;
+  unsigned int pipeline;
+  struct networkfs_endpoint endpoint;
+  bool inet_set;  // host or port is given, so unix is not allowed
+  unsigned int timeo;
+  unsigned int retrans;
+  bool hedge;
+  bool compress;
+  unsigned int vers;  // NFS_WIRE_*
+  unsigned int negttl;
+  // Bounds of how long a name is trusted without asking the server, seconds
+  unsigned int acregmin;
+  unsigned int acregmax;
+  unsigned int acdirmin;
+  unsigned int acdirmax;
+  bool rdirplus;
+  int rx_cpu;  // where asynchronous calls run, -1 if any
+  struct networkfs_sock_opts sock_opts;  // timeout is set from timeo
+};
+
+struct networkfs_sb_info {
+  char *token;
+  struct networkfs_conn_pool pool;
+  struct workqueue_struct *wq;  // asynchronous calls, see remote/rpc.h
+  int rx_cpu;                   // where asynchronous calls run, -1 if any
+
+  unsigned long timeout;  // of every attempt, in jiffies
+  unsigned int retrans;
+  bool hedge;
+  struct networkfs_latency read_latency;  // collected only if hedge is set
+  wait_queue_head_t hedge_wait;
+  bool compress;           // responses may come LZ4 compressed
+  unsigned int vers;       // wire format of responses, NFS_WIRE_*
+  unsigned long neg_ttl;   // of negative dentries, in jiffies
+  unsigned long acregmin;  // in jiffies, see struct networkfs_inode_info
+  unsigned long acregmax;
+  unsigned long acdirmin;
+  unsigned long acdirmax;
+  bool rdirplus;  // listings carry attributes and fill the caches
+};
+
+#define NFS_SB(sb) ((struct networkfs_sb_info *)(sb)->s_fs_info)
+
+// Listing of a directory reused by getdents calls, see operations/file.c
+struct networkfs_dir_cache {
+  struct rw_semaphore sem;
+  struct xarray entries;  // by cookie, a prefix of the listing
+  bool valid;
+  bool eof;               // entries hold the whole listing
+  unsigned long fetched;  // jiffies, when its first page was asked for
+  u64 end;                // cookie of the last entry, 0 if none
+  size_t count;
+  u64 gen;  // bumped on invalidation, so pages in flight are not added
+};
+
+// Allocated by networkfs_alloc_inode() in place of bare inodes
+struct networkfs_inode_info {
+  struct inode vfs_inode;
+  // Dentries of the inode are trusted until verified + attr_timeo, cached
+  // attributes until attr_fetched + attr_timeo. The timeout starts at ac*min
+  // and doubles up to ac*max every time the server confirms the entry
+  // unchanged, it restarts from ac*min once its ctime changes.
+  unsigned long verified;      // jiffies
+  unsigned long attr_fetched;  // jiffies, valid if attr_valid is set
+  unsigned long attr_timeo;    // jiffies
+  bool attr_valid;
+  // Files open on the inode, their content fixes its size until closed
+  atomic_t open_files;
+  struct networkfs_dir_cache rdir;  // of directories, valid for attr_timeo
+};
+
+#define NFS_I(inode) \
+  container_of((inode), struct networkfs_inode_info, vfs_inode)
+
 #endif
@@ -0,0 +1,16 @@
+#ifndef NETWORKFS_DENTRY
+#define NETWORKFS_DENTRY
+
+#include <linux/dcache.h>
+
+#include "remote/request.h"
+
+extern const struct dentry_operations networkfs_dentry_ops;
+
+int networkfs_d_revalidate(struct dentry *, unsigned int);
+
+void networkfs_dentry_set_negative(struct dentry *);
+void networkfs_dentry_prime(struct dentry *, const char *, size_t,
+                            const struct networkfs_attr *);
+
+#endif
@@ -7,10 +7,19 @@
 extern struct file_operations networkfs_dir_ops;
 
 int networkfs_iterate(struct file *, struct dir_context *);
+loff_t networkfs_llseek(struct file *, loff_t, int);
+
+void networkfs_dir_cache_invalidate(struct inode *);
+void networkfs_dir_cache_drop(struct inode *);
 
 int networkfs_open(struct inode *, struct file *);
+// Open of a file read along with its lookup, for finish_open(): private_data
+// holds the content in the layout of networkfs_request_read() and is taken
+int networkfs_open_prefetched(struct inode *, struct file *);
 ssize_t networkfs_read(struct file *, char *, size_t, loff_t *);
 ssize_t networkfs_write(struct file *, const char *, size_t, loff_t *);
+// Truncates or extends the content of an open file
+void networkfs_file_set_size(struct file *, loff_t);
 
 int networkfs_flush(struct file *, fl_owner_t);
 int networkfs_fsync(struct file *, loff_t, loff_t, int);
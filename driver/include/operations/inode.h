@@ -4,8 +4,19 @@
 #include <linux/fs.h>
 #include <linux/types.h>
 
+#include "remote/request.h"
+
+int networkfs_inode_cache_init(void);
+void networkfs_inode_cache_destroy(void);
+struct inode *networkfs_alloc_inode(struct super_block *);
+void networkfs_destroy_inode(struct inode *);
+void networkfs_free_inode(struct inode *);
+
 struct inode *networkfs_get_inode(struct super_block *, const struct inode *,
-                                  umode_t, int);
+                                  umode_t, ino_t);
+void networkfs_inode_confirmed(struct inode *);
+void networkfs_inode_update(struct inode *, const struct networkfs_attr *);
+void networkfs_inode_invalidate_attr(struct inode *);
 
 int networkfs_mkdir(struct mnt_idmap *, struct inode *, struct dentry *,
                     umode_t);
@@ -15,8 +26,12 @@ int networkfs_unlink(struct inode *, struct dentry *);
 int networkfs_create(struct mnt_idmap *, struct inode *, struct dentry *,
                      umode_t, bool);
 struct dentry *networkfs_lookup(struct inode *, struct dentry *, unsigned int);
+int networkfs_atomic_open(struct inode *, struct dentry *, struct file *,
+                          unsigned int, umode_t);
 
 int networkfs_setattr(struct mnt_idmap *, struct dentry *, struct iattr *);
+int networkfs_getattr(struct mnt_idmap *, const struct path *, struct kstat *,
+                      u32, unsigned int);
 
 int networkfs_link(struct dentry *, struct inode *, struct dentry *);
 
@@ -8,6 +8,8 @@ void networkfs_kill_sb(struct super_block *);
 int networkfs_fill_super(struct super_block *, struct fs_context *);
 int networkfs_get_tree(struct fs_context *);
 
+int networkfs_parse_param(struct fs_context *, struct fs_parameter *);
+void networkfs_free_fc(struct fs_context *);
 int networkfs_init_fs_context(struct fs_context *);
 
 #endif
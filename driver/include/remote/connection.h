@@ -0,0 +1,153 @@
+#ifndef NETWORKFS_CONNECTION
+#define NETWORKFS_CONNECTION
+
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+
+#define NFS_POOL_DEFAULT 4
+#define NFS_POOL_MAX 64
+#define NFS_PIPELINE_DEFAULT 1
+#define NFS_PIPELINE_MAX 32
+#define NFS_RBUF_SIZE 1024
+#define NFS_PORT_DEFAULT 8080
+
+// Server address, either TCP (AF_INET) or a Unix domain socket (AF_UNIX)
+struct networkfs_endpoint {
+  struct sockaddr_storage addr;
+  int addrlen;
+};
+
+// Tuning applied to every socket of a pool
+struct networkfs_sock_opts {
+  unsigned long timeout;   // of connect, send and receive, in jiffies
+  bool nodelay;            // TCP_NODELAY
+  int sndbuf;              // SO_SNDBUF, 0 for the system default
+  int rcvbuf;              // SO_RCVBUF, 0 for the system default
+  unsigned int busy_poll;  // SO_BUSY_POLL, microseconds
+};
+
+struct networkfs_conn {
+  const struct networkfs_conn_pool *pool;
+  struct socket *sock;  // NULL until the slot is first used or after a failure
+  unsigned int users;   // callers holding the connection, under pool lock
+  bool broken;          // socket failed, every request in flight fails
+  bool eof;             // peer closed the socket, set by the receiver
+
+  // Requests in flight in the order they were sent. HTTP responses come back
+  // in the same order, so the caller at the head reads the next response.
+  // Turns of killed callers stay queued as abandoned ones, and their
+  // responses are read and dropped by whoever waits behind them.
+  struct mutex send_lock;
+  spinlock_t queue_lock;
+  struct list_head queue;
+  wait_queue_head_t turn;
+  bool draining;  // a caller reads the response of the abandoned head turn
+
+  // Received bytes that are not parsed yet: headers of the current response
+  // and whatever follows them, possibly the next pipelined responses
+  char rbuf[NFS_RBUF_SIZE];
+  size_t rbuf_start;
+  size_t rbuf_end;
+};
+
+// Place of a request in the response order, lives on the caller's stack
+// unless abandoned
+struct networkfs_conn_turn {
+  struct list_head node;
+  bool written;    // some of the request reached the socket
+  bool idle;       // no other request was in flight when it was sent
+  bool abandoned;  // allocated in place of the turn of a killed caller
+};
+
+struct networkfs_conn_pool {
+  struct networkfs_endpoint endpoint;
+  struct networkfs_sock_opts sock_opts;
+  spinlock_t lock;
+  wait_queue_head_t wait;
+  size_t size;
+  unsigned int depth;  // maximal number of requests in flight per connection
+  struct networkfs_conn *conns;
+};
+
+int networkfs_pool_init(struct networkfs_conn_pool *pool,
+                        const struct networkfs_endpoint *endpoint,
+                        const struct networkfs_sock_opts *sock_opts,
+                        size_t size, unsigned int depth);
+void networkfs_pool_destroy(struct networkfs_conn_pool *pool);
+
+/**
+ * networkfs_conn_get - check out a connection from the pool.
+ * @pool: Connection pool of the superblock.
+ * @conn: Where to store the checked out connection.
+ *
+ * Idle connected sockets are preferred, then empty slots, and only then
+ * connections that already carry other requests (if pipelining is enabled).
+ * Sleeps if every connection is at its pipelining depth.
+ *
+ * Return: 0 on success or -ERESTARTSYS if interrupted by a signal.
+ */
+int networkfs_conn_get(struct networkfs_conn_pool *pool,
+                       struct networkfs_conn **conn);
+
+/**
+ * networkfs_conn_put - return a connection to the pool.
+ * @pool: Connection pool the connection was taken from.
+ * @conn: Connection to return.
+ *
+ * The last user of a broken connection closes its socket, so the slot
+ * reconnects on next use.
+ */
+void networkfs_conn_put(struct networkfs_conn_pool *pool,
+                        struct networkfs_conn *conn);
+
+/**
+ * networkfs_conn_send - send a request and take a place in the response order.
+ * @conn:   Checked out connection.
+ * @turn:   Queue entry of the caller; after success it must be released with
+ *          networkfs_conn_finish(). Its @written is set on failure as well.
+ * @vec:    Request data.
+ * @nvec:   Number of elements in @vec.
+ * @length: Total request size.
+ *
+ * Connects the socket if necessary. A kept-alive socket that the server has
+ * already closed is reopened when no other request is in flight on it.
+ *
+ * Return: 1 if the request went over a new socket, 0 if it went over a reused
+ * one, or negated errno from `http.h` on failure.
+ */
+int networkfs_conn_send(struct networkfs_conn *conn,
+                        struct networkfs_conn_turn *turn, struct kvec *vec,
+                        size_t nvec, size_t length);
+
+/**
+ * networkfs_conn_wait_turn - wait until the response to @turn is next.
+ *
+ * The wait is killable. A killed caller leaves an abandoned turn in place of
+ * @turn, which must not be finished then, so that the stream stays in sync.
+ *
+ * Return: 0 when the caller may read its response, 1 when the next response
+ * is of an abandoned turn, which the caller reads, drops and finishes with
+ * networkfs_conn_finish(@conn, NULL, ...) before waiting again, -EINTR if
+ * killed, or -ESOCKNOMSGRECV if the connection broke.
+ */
+int networkfs_conn_wait_turn(struct networkfs_conn *conn,
+                             struct networkfs_conn_turn *turn);
+
+/**
+ * networkfs_conn_finish - leave the response order.
+ * @conn:  Connection the request was sent over.
+ * @turn:  Queue entry of the caller, NULL for the abandoned head turn.
+ * @error: Whether the response was not read completely. The connection is
+ *         then broken, since the response stream is out of sync.
+ */
+void networkfs_conn_finish(struct networkfs_conn *conn,
+                           struct networkfs_conn_turn *turn, bool error);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef NETWORKFS_HTTP
 #define NETWORKFS_HTTP
 
+#include <linux/build_bug.h>
+#include <linux/compiler_attributes.h>
 #include <linux/types.h>
 
 #define ESOCKNOCREATE 0x2001
@@ -10,27 +12,104 @@
 #define EHTTPBADCODE 0x2005
 #define EHTTPMALFORMED 0x2006
 #define EPROTMALFORMED 0x2007
+#define ESOCKTIMEOUT 0x2008
+#define EPROTVERSION 0x2009
+
+// Wire format of response bodies, negotiated per request
+#define NFS_WIRE_LEGACY 1  // native structs of the server, see README
+#define NFS_WIRE_PACKED 2  // little-endian, see remote/request.c
+
+#define NFS_HTTP_MAX_ARGS 4
+
+struct networkfs_conn_pool;
+struct networkfs_op;
+
+// Leading bytes of a response body in the packed format. In the legacy
+// format they are the status as a native int64_t.
+struct networkfs_wire_header {
+  u8 version;  // NFS_WIRE_PACKED
+  u8 reserved;
+  __le16 status;
+  __le32 length;  // of the payload that follows
+} __packed;
+
+static_assert(sizeof(struct networkfs_wire_header) == sizeof(int64_t));
+
+enum networkfs_arg_kind {
+  NFS_ARG_NUM,  // @number, sent in decimal
+  NFS_ARG_STR,  // @value of @len bytes, URL-encoded when sent
+  NFS_ARG_REF,  // ino returned by call @number of a compound, see
+                // networkfs_compound_ref()
+};
+
+struct networkfs_http_arg {
+  const char *key;  // with the separator, e.g. "&name="
+  size_t key_len;
+  enum networkfs_arg_kind kind;
+  const char *value;
+  size_t len;
+  u64 number;
+};
+
+// Prepared by the encoders from `remote/ops.h`
+struct networkfs_http_req {
+  const struct networkfs_op *op;
+  struct networkfs_http_arg args[NFS_HTTP_MAX_ARGS];
+  size_t arg_size;
+
+  // Payload sent as the raw `application/octet-stream` body of a POST request,
+  // GET is used if NULL. Unlike arguments, it is neither encoded nor copied.
+  const void *body;
+  size_t body_size;
+
+  char *response;
+  size_t response_size;
+  // Bytes of the payload stored in @response, set by the call. Payloads are
+  // decoded up to it, the rest of @response is left as it was.
+  size_t received;
+
+  // Optional, takes the payload in pieces as it arrives instead of @response,
+  // so its size is not bounded. A negative return fails the call with that
+  // error, the rest of the response is dropped. Only for synchronous calls,
+  // the request is usually embedded into the consumer state.
+  int (*consume)(struct networkfs_http_req *req, const void *data,
+                 size_t len);
+  // Bytes passed to @consume, the call is never repeated once they are not 0
+  size_t consumed;
+
+  // Let the server send the response body compressed with LZ4
+  bool compress;
+  // Wire format the response payload is expected in, NFS_WIRE_*. The server
+  // must confirm it, otherwise the call fails with -EPROTVERSION.
+  unsigned int version;
+
+  // Optional, called right before the request goes to the wire. Returning
+  // false aborts the call with -ECANCELED.
+  bool (*may_send)(struct networkfs_http_req *req);
+};
 
 /**
- * networkfs_http_call - make a call to networkfs API.
- * @token:           Unique filesystem token.
- * @method:          API method name, e.g. "list" for fs.list.
- * @response_buffer: Pointer to memory space for writing the response.
- *                   There should be available at least @buffer_size bytes.
- * @arg_size:        Number of arguments provided.
- * @...:             Exactly thrice of @arg_size string arguments in format
- *                   key1, value1, len1, key2, value2, len2, ...
+ * networkfs_http_exec - make a call to networkfs API.
+ * @pool:  Connections to the server that owns the call.
+ * @token: Token of the bucket.
+ * @req:   Call description. @req->response should have at least
+ *         @req->response_size bytes available.
  *
- * This method makes an HTTP call to networkfs API server and parses the result.
+ * This method makes an HTTP call to networkfs API server over a kept-alive
+ * connection from @pool and parses the result. If @req->compress is set,
+ * the server may answer with an LZ4 compressed body, which is decompressed
+ * transparently. Bodies sent with `Transfer-Encoding: chunked` are accepted
+ * as well.
  *
  * Return:
- * * If HTTP session succeeds, returns `result->status`.
- *   `result->response` is written into @response_buffer.
+ * * If HTTP session succeeds, returns the status of the response. Payload
+ *   that follows the status is received into @req->response as is, or
+ *   passed to @req->consume.
  * * Otherwise, returns negated errno, either defined in `errno-base.h`
- *   or in `http.h`, and @response_buffer stays unaltered.
+ *   or in `http.h`, and contents of @req->response are undefined.
  */
-int64_t networkfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...);
+int64_t networkfs_http_exec(struct networkfs_conn_pool *pool,
+                            const char *token,
+                            struct networkfs_http_req *req);
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef NETWORKFS_OPS
+#define NETWORKFS_OPS
+
+#include <linux/dcache.h>
+#include <linux/types.h>
+
+#include "remote/http.h"
+
+#define NFS_OP_IDEMPOTENT 0x1  // may be repeated after the server executed it
+#define NFS_OP_HEDGED 0x2      // is hedged if the `hedge` mount option is set
+
+/*
+ * Calls of networkfs API, OP(name, flags, args). Arguments of every call are
+ * listed by an X-macro of their own, ARG(type, key), with types:
+ *   ino - inode number;
+ *   num - any other number;
+ *   str - string, URL-encoded when sent.
+ * Inode numbers and numbers are sent in decimal.
+ */
+#define NFS_OPS(OP)                                          \
+  OP(lookup, NFS_OP_IDEMPOTENT, NFS_LOOKUP_ARGS)             \
+  OP(list, NFS_OP_IDEMPOTENT, NFS_LIST_ARGS)                 \
+  OP(create, 0, NFS_CREATE_ARGS)                             \
+  OP(read, NFS_OP_IDEMPOTENT | NFS_OP_HEDGED, NFS_READ_ARGS) \
+  OP(write, 0, NFS_WRITE_ARGS)                               \
+  OP(link, 0, NFS_LINK_ARGS)                                 \
+  OP(unlink, 0, NFS_UNLINK_ARGS)                             \
+  OP(rmdir, 0, NFS_RMDIR_ARGS)                               \
+  OP(getattr, NFS_OP_IDEMPOTENT, NFS_GETATTR_ARGS)           \
+  OP(listplus, NFS_OP_IDEMPOTENT, NFS_LISTPLUS_ARGS)         \
+  OP(lookup_path, NFS_OP_IDEMPOTENT, NFS_LOOKUP_PATH_ARGS)   \
+  OP(compound, 0, NFS_COMPOUND_ARGS)
+
+#define NFS_LOOKUP_ARGS(ARG) ARG(ino, parent) ARG(str, name)
+#define NFS_LIST_ARGS(ARG) ARG(ino, inode) ARG(num, cookie) ARG(num, count)
+#define NFS_CREATE_ARGS(ARG) ARG(ino, parent) ARG(str, name) ARG(str, type)
+#define NFS_READ_ARGS(ARG) ARG(ino, inode)
+#define NFS_WRITE_ARGS(ARG) ARG(ino, inode)
+#define NFS_LINK_ARGS(ARG) ARG(ino, source) ARG(ino, parent) ARG(str, name)
+#define NFS_UNLINK_ARGS(ARG) ARG(ino, parent) ARG(str, name)
+#define NFS_RMDIR_ARGS(ARG) ARG(ino, parent) ARG(str, name)
+#define NFS_GETATTR_ARGS(ARG) ARG(ino, inode)
+#define NFS_LISTPLUS_ARGS(ARG) NFS_LIST_ARGS(ARG)
+#define NFS_LOOKUP_PATH_ARGS(ARG) ARG(ino, parent) ARG(str, path)
+// Calls of a compound are sent in the body, see remote/request.h
+#define NFS_COMPOUND_ARGS(ARG)
+
+typedef u64 networkfs_arg_ino;
+typedef u64 networkfs_arg_num;
+typedef struct qstr networkfs_arg_str;
+
+struct networkfs_op {
+  const char *name;
+  const char *path;  // "/fs/<name>?", the query follows
+  size_t path_len;
+  unsigned int flags;  // NFS_OP_*
+};
+
+#define NFS_OP_ID(call, call_flags, call_args) NFS_OP_##call,
+enum networkfs_op_id { NFS_OPS(NFS_OP_ID) NFS_OP_COUNT };
+#undef NFS_OP_ID
+
+extern const struct networkfs_op networkfs_ops[NFS_OP_COUNT];
+
+// For every call: struct networkfs_<name>_args with typed arguments and
+// networkfs_<name>_encode(), which prepares the request from them. Strings
+// are referenced by the request, the response buffer and the body are set
+// by the caller afterwards.
+#define NFS_OP_ARG_FIELD(type, field) networkfs_arg_##type field;
+#define NFS_OP_DECLARE(call, call_flags, call_args)              \
+  struct networkfs_##call##_args {                               \
+    call_args(NFS_OP_ARG_FIELD)                                  \
+  };                                                             \
+  void networkfs_##call##_encode(struct networkfs_http_req *req, \
+                                 const struct networkfs_##call##_args *args);
+NFS_OPS(NFS_OP_DECLARE)
+#undef NFS_OP_DECLARE
+#undef NFS_OP_ARG_FIELD
+
+#endif
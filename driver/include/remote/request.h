@@ -4,13 +4,31 @@
 #include <linux/fs.h>
 #include <linux/types.h>
 
+#define NFS_DIR_ENTRIES_MAX 16  // of a listing page in the legacy format
+#define NFS_DIR_PAGE_MAX 128    // in the packed format
+#define NFS_NAME_MAX 255
+#define NFS_LOOKUP_PATH_MAX 8  // components resolved by a single call
+#define NFS_COMPOUND_MAX 4     // calls of a compound
+#define NFS_COMPOUND_BODY_MAX 2048
+#define NFS_COMPOUND_RESPONSE_MAX 1024
+
+struct networkfs_http_req;
+struct networkfs_sb_info;
+
+/*
+ * Listings are paged by cookies: the server numbers the entries of every
+ * directory in the order they are added, a page holds the entries following
+ * the given cookie. Cookies start at 1, so 0 lists from the start.
+ */
 struct networkfs_dir_entries {
   size_t entries_count;
+  bool eof;  // no entries follow this page
   struct networkfs_dir_entry {
     unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
     ino_t ino;
-    char name[256];
-  } entries[16];
+    u64 cookie;
+    char name[NFS_NAME_MAX + 1];
+  } entries[NFS_DIR_ENTRIES_MAX];
 };
 
 struct networkfs_entry_info {
@@ -18,12 +36,61 @@ struct networkfs_entry_info {
   ino_t ino;
 };
 
+// Entries of the components of a path, up to the first one missing
+struct networkfs_path_info {
+  size_t count;
+  struct networkfs_entry_info entries[NFS_LOOKUP_PATH_MAX];
+};
+
+struct networkfs_attr {
+  unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
+  ino_t ino;
+  u64 size;
+  u64 nlink;
+  s64 mtime;  // nanoseconds since the epoch
+  s64 ctime;
+};
+
+struct networkfs_dir_entries_plus {
+  size_t entries_count;
+  bool eof;
+  struct networkfs_dir_entry_plus {
+    struct networkfs_attr attr;
+    u64 cookie;
+    char name[NFS_NAME_MAX + 1];
+  } entries[NFS_DIR_ENTRIES_MAX];
+};
+
+// Called for every entry of a listed page, returns false to skip the rest.
+// Only the type and ino of @attr are set unless the listing is a listplus one.
+typedef bool (*networkfs_dir_actor_t)(void *data, const char *name,
+                                      size_t len, u64 cookie,
+                                      const struct networkfs_attr *attr);
 
 int64_t networkfs_request_lookup(const struct inode *parent,
                                  const struct dentry *child,
                                  struct networkfs_entry_info *result);
-int64_t networkfs_request_iterate(const struct file *filp,
-                                  struct networkfs_dir_entries *result);
+int64_t networkfs_request_lookup_path(const struct inode *parent,
+                                      struct qstr path,
+                                      struct networkfs_path_info *result);
+/**
+ * networkfs_request_iterate - list a page of a directory.
+ * @filp:   The directory.
+ * @plus:   List with listplus, so @actor gets full attributes.
+ * @cookie: Cookie of the last entry already listed, 0 to list from the start.
+ * @eof:    Set if no entries follow the page.
+ * @actor:  Called for every entry of the page.
+ * @data:   Passed to @actor.
+ *
+ * A page holds up to NFS_DIR_ENTRIES_MAX entries in the legacy format and
+ * NFS_DIR_PAGE_MAX in the packed one, so listing a directory of any size
+ * takes bounded memory and time linear in its size.
+ *
+ * Return: 0 or a negative error code.
+ */
+int64_t networkfs_request_iterate(const struct file *filp, bool plus,
+                                  u64 cookie, bool *eof,
+                                  networkfs_dir_actor_t actor, void *data);
 
 int64_t networkfs_request_unlink(const struct inode *parent,
                                  const struct dentry *child);
@@ -41,7 +108,89 @@ int64_t networkfs_request_read(const struct inode *inode,
 
 int64_t networkfs_request_write(const struct file *filp, size_t size);
 
+int64_t networkfs_request_getattr(const struct inode *inode,
+                                  struct networkfs_attr *result);
+
 int64_t networkfs_request_link(struct dentry *target, struct inode *parent,
                                struct dentry *child);
 
+/**
+ * networkfs_request_open - look up a name and read the file it refers to.
+ * @parent:      Directory of the name.
+ * @child:       Dentry of the name.
+ * @trunc:       Empty the file with a write instead of reading it.
+ * @result:      Entry of the name.
+ * @buffer:      Content in the layout of networkfs_request_read(), untouched
+ *               if the entry is a directory.
+ * @buffer_size: Size of @buffer.
+ *
+ * Both calls go in a single compound, so the packed format is needed: in the
+ * legacy one this fails with -EOPNOTSUPP and callers look the name up and
+ * read the file on their own (see networkfs_atomic_open()).
+ *
+ * Return: 0 or a negative error code, -ENOENT if the name is missing.
+ */
+int64_t networkfs_request_open(const struct inode *parent,
+                               const struct dentry *child, bool trunc,
+                               struct networkfs_entry_info *result,
+                               void *buffer, size_t buffer_size);
+
+/*
+ * Calls sent to the server as a single request, modelled on NFSv4 COMPOUND:
+ * the server executes them in order and stops at the first one that fails.
+ * A number argument may take the ino returned by an earlier create, lookup or
+ * getattr, see networkfs_compound_ref(). Compounds need the packed format.
+ */
+struct networkfs_compound {
+  struct networkfs_sb_info *sbi;
+  bool idempotent;  // every call is, so the compound may be repeated
+  int error;        // of adding a call, returned by networkfs_compound_exec()
+  size_t count;
+  size_t body_size;
+  u8 body[NFS_COMPOUND_BODY_MAX];
+
+  // Set by networkfs_compound_exec(), the last call executed failed unless
+  // its status is 0
+  size_t executed;
+  struct networkfs_compound_result {
+    u64 status;
+    const u8 *payload;  // in the packed format, points into @response
+    size_t size;
+  } results[NFS_COMPOUND_MAX];
+  u8 response[NFS_COMPOUND_RESPONSE_MAX];
+};
+
+// Compounds are too large for the stack, they are freed with kfree()
+struct networkfs_compound *networkfs_compound_alloc(
+    struct networkfs_sb_info *sbi);
+
+/**
+ * networkfs_compound_add - append a call to a compound.
+ * @c:   The compound.
+ * @req: Call from an encoder of `remote/ops.h`, with the body set if any.
+ *
+ * Arguments and the body are copied, so @req may go right after the call.
+ * The first error is kept in @c, so calls may be added unchecked.
+ *
+ * Return: 0 or a negative error code.
+ */
+int networkfs_compound_add(struct networkfs_compound *c,
+                           const struct networkfs_http_req *req);
+
+// Makes a number argument take the ino returned by call @call of the compound
+// it is added to, the call should come earlier
+void networkfs_compound_ref(struct networkfs_http_arg *arg, size_t call);
+
+/**
+ * networkfs_compound_exec - make the calls of a compound.
+ * @c: The compound.
+ *
+ * Results of the calls executed are decoded into @c->results, their payloads
+ * altogether should fit NFS_COMPOUND_RESPONSE_MAX bytes.
+ *
+ * Return: 0 if every call succeeded, the status of the call that failed,
+ * or a negative error code.
+ */
+int64_t networkfs_compound_exec(struct networkfs_compound *c);
+
 #endif
@@ -0,0 +1,131 @@
+#ifndef NETWORKFS_RPC
+#define NETWORKFS_RPC
+
+#include <linux/completion.h>
+#include <linux/kref.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "remote/http.h"
+
+#define NFS_RETRY_BACKOFF (HZ / 10)
+#define NFS_LATENCY_BUCKETS 32
+#define NFS_LATENCY_WINDOW 4096      // samples, then old ones are aged
+#define NFS_LATENCY_MIN_SAMPLES 100  // before the percentile is trusted
+
+// Log2 histogram of call latencies: bucket i counts [2^(i-1), 2^i) us
+struct networkfs_latency {
+  spinlock_t lock;
+  u32 buckets[NFS_LATENCY_BUCKETS];
+  u32 total;
+};
+
+struct networkfs_mount_options;
+struct networkfs_sb_info;
+struct networkfs_rpc;
+
+typedef void (*networkfs_rpc_done_t)(struct networkfs_rpc *rpc);
+
+enum networkfs_rpc_state {
+  NFS_RPC_QUEUED,  // waiting for a worker or a connection
+  NFS_RPC_SENT,    // request is on the wire, response has to be consumed
+  NFS_RPC_DONE,
+};
+
+// Asynchronous call to networkfs API, executed on the workqueue of the mount
+struct networkfs_rpc {
+  struct kref ref;
+  struct work_struct work;
+  struct completion done;
+  struct networkfs_sb_info *sbi;
+
+  struct networkfs_http_req req;
+  char *values;  // copies of argument values, owned by the call
+  char *buffer;  // response buffer owned by the call, if any
+
+  spinlock_t lock;
+  enum networkfs_rpc_state state;
+  bool cancelled;
+
+  networkfs_rpc_done_t callback;
+  void *data;  // for the callback
+  int64_t result;
+};
+
+// Connects the superblock to the server given at mount time
+int networkfs_rpc_init(struct networkfs_sb_info *sbi,
+                       const struct networkfs_mount_options *opts);
+void networkfs_rpc_destroy(struct networkfs_sb_info *sbi);
+
+/**
+ * networkfs_rpc_call - make a synchronous call to networkfs API.
+ * @sbi: Filesystem info of the mount.
+ * @req: Call from an encoder of `remote/ops.h`, with the response buffer and
+ *       the body set.
+ *
+ * Runs in the caller's context. A signal interrupts the call while it waits
+ * for a connection; once the request is sent, the response is always awaited.
+ * Every attempt is bounded by the `timeo` mount option. Attempts that failed
+ * before reaching the server, and failed attempts of idempotent calls, are
+ * repeated up to `retrans` times with exponential backoff. Reads are hedged
+ * if the `hedge` mount option is set.
+ *
+ * Return: same as networkfs_http_exec().
+ */
+int64_t networkfs_rpc_call(struct networkfs_sb_info *sbi,
+                           struct networkfs_http_req *req);
+
+/**
+ * networkfs_rpc_alloc - prepare an asynchronous call to networkfs API.
+ * @sbi: Filesystem info of the mount.
+ * @req: Call from an encoder of `remote/ops.h`. String arguments are copied.
+ *
+ * The body and the response buffer are taken from @req, or set directly in
+ * `rpc->req`, and are referenced until the call is completed or cancelled.
+ *
+ * Return: new call with a single reference, or NULL if out of memory.
+ */
+struct networkfs_rpc *networkfs_rpc_alloc(
+    struct networkfs_sb_info *sbi, const struct networkfs_http_req *req);
+
+void networkfs_rpc_get(struct networkfs_rpc *rpc);
+void networkfs_rpc_put(struct networkfs_rpc *rpc);
+
+/**
+ * networkfs_rpc_submit - start an asynchronous call.
+ * @rpc:      Call from networkfs_rpc_alloc().
+ * @callback: Optional, called exactly once when the call completes or is
+ *            cancelled, from the workqueue or from the cancelling thread.
+ *            The result is in `rpc->result`.
+ * @data:     Stored in `rpc->data` for @callback.
+ *
+ * The call holds its own reference while in flight, so the submitter may drop
+ * its reference right away if it only needs the callback.
+ */
+void networkfs_rpc_submit(struct networkfs_rpc *rpc,
+                          networkfs_rpc_done_t callback, void *data);
+
+/**
+ * networkfs_rpc_cancel - cancel a call that is not sent yet.
+ *
+ * Return: true if the call will not touch its body and response buffer
+ * anymore and completes with -ECANCELED, false if the request is already on
+ * the wire and the call completes normally.
+ */
+bool networkfs_rpc_cancel(struct networkfs_rpc *rpc);
+
+// Whether the call has completed and `rpc->result` is set
+bool networkfs_rpc_done(struct networkfs_rpc *rpc);
+
+/**
+ * networkfs_rpc_wait - wait for completion of a submitted call.
+ *
+ * If a signal arrives first, the call is cancelled when possible.
+ *
+ * Return: `rpc->result`, or -EINTR if the call was cancelled by a signal.
+ */
+int64_t networkfs_rpc_wait(struct networkfs_rpc *rpc);
+
+#endif
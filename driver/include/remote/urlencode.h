@@ -0,0 +1,24 @@
+#ifndef NETWORKFS_URLENCODE
+#define NETWORKFS_URLENCODE
+
+// Shared with the userspace benchmark in bench/
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#endif
+
+/**
+ * networkfs_urlencode - percent-encode a byte string.
+ * @dst: Destination, there should be available at least 3 * @len + 1 bytes.
+ * @src: Source bytes, may contain zeroes.
+ * @len: Number of bytes in @src.
+ *
+ * Letters and digits are copied as is, every other byte becomes `%XX`.
+ * The result is zero-terminated.
+ *
+ * Return: length of the encoded string without the terminating zero.
+ */
+size_t networkfs_urlencode(char *dst, const char *src, size_t len);
+
+#endif
@@ -12,10 +12,6 @@
 #define NFS_NOTEMPTY 8
 #define NFS_BIGNAME 9
 
-#define ino_to_string(var, src) \
-  char var[19];                 \
-  sprintf(var, "%lu", (src));
-
 #define wstr(var) (var), strlen(var)
 
 #endif
@@ -3,6 +3,7 @@
 #include <linux/module.h>
 #include <linux/types.h>
 
+#include "operations/inode.h"
 #include "operations/mount.h"
 
 MODULE_LICENSE("GPL");
@@ -17,7 +18,17 @@ struct file_system_type networkfs_fs_type = {
     .init_fs_context = networkfs_init_fs_context,
     .kill_sb = networkfs_kill_sb};
 
-int networkfs_init(void) { return register_filesystem(&networkfs_fs_type); }
+int networkfs_init(void) {
+  int errcode = networkfs_inode_cache_init();
+  if (errcode != 0) {
+    return errcode;
+  }
+  errcode = register_filesystem(&networkfs_fs_type);
+  if (errcode != 0) {
+    networkfs_inode_cache_destroy();
+  }
+  return errcode;
+}
 
 void networkfs_exit(void) {
   int errcode = unregister_filesystem(&networkfs_fs_type);
@@ -25,6 +36,7 @@ void networkfs_exit(void) {
     printk(KERN_ERR
            "networkfs: unregister_filesystem() failed: error code %d\n",
            errcode);
+  networkfs_inode_cache_destroy();
 }
 
 module_init(networkfs_init);
@@ -0,0 +1,197 @@
+#include "operations/dentry.h"
+
+#include <linux/fs.h>
+#include <linux/jiffies.h>
+#include <linux/namei.h>
+#include <linux/slab.h>
+#include <linux/stringhash.h>
+#include <linux/wait.h>
+
+#include "networkfs.h"
+#include "operations/inode.h"
+#include "remote/request.h"
+
+const struct dentry_operations networkfs_dentry_ops = {
+    .d_revalidate = networkfs_d_revalidate};
+
+static bool dentry_expired(struct dentry *dentry) {
+  struct inode *inode = d_inode(dentry);
+  if (inode == NULL) {
+    return false;
+  }
+  struct networkfs_inode_info *info = NFS_I(inode);
+  return !time_before(jiffies,
+                      READ_ONCE(info->verified) + READ_ONCE(info->attr_timeo));
+}
+
+static bool entry_matches(const struct networkfs_entry_info *entry,
+                          struct inode *inode) {
+  // otherwise the name was removed and created again, possibly as another type
+  return entry->ino == inode->i_ino && entry->entry_type == dt_type(inode);
+}
+
+// Asks the server whether the name still refers to the same inode
+static int dentry_verify_one(struct dentry *dentry, struct inode *inode) {
+  struct dentry *parent = dget_parent(dentry);
+  struct networkfs_entry_info entry;
+  int error = networkfs_request_lookup(d_inode(parent), dentry, &entry);
+  dput(parent);
+
+  if (error == -ENOENT) {
+    return 0;
+  }
+  if (error < 0) {
+    return error;
+  }
+  if (!entry_matches(&entry, inode)) {
+    return 0;
+  }
+  networkfs_inode_confirmed(inode);
+  return 1;
+}
+
+/*
+ * Walks revalidate only the names they pass, so names above a dentry reached
+ * from the working directory or a file descriptor may be past their timeout
+ * as well. Those up to the nearest trusted ancestor are confirmed along with
+ * the dentry by a single lookup_path call. The VFS hands ->lookup() a single
+ * component, so names below are still resolved one call each.
+ */
+static int dentry_verify(struct dentry *dentry, struct inode *inode) {
+  // chain[0] is the dentry, chain[depth - 1] the topmost expired ancestor
+  struct dentry *chain[NFS_LOOKUP_PATH_MAX];
+  size_t depth = 0;
+  struct dentry *base = dget(dentry);
+  do {
+    chain[depth++] = base;
+    base = dget_parent(base);
+  } while (depth < NFS_LOOKUP_PATH_MAX && !IS_ROOT(base) &&
+           dentry_expired(base));
+
+  if (depth == 1) {
+    dput(base);
+    dput(chain[0]);
+    return dentry_verify_one(dentry, inode);
+  }
+
+  int error = -ENOMEM;
+  char *path = kmalloc(NFS_LOOKUP_PATH_MAX * (NFS_NAME_MAX + 1), GFP_KERNEL);
+  struct networkfs_path_info *info =
+      kmalloc(sizeof(struct networkfs_path_info), GFP_KERNEL);
+  if (path != NULL && info != NULL) {
+    size_t len = 0;
+    for (size_t i = depth; i-- > 0;) {
+      const struct qstr *name = &chain[i]->d_name;
+      memcpy(path + len, name->name, name->len);
+      len += name->len;
+      path[len++] = '/';
+    }
+    struct qstr names = QSTR_INIT(path, len - 1);  // without the last '/'
+    error = networkfs_request_lookup_path(d_inode(base), names, info);
+  }
+
+  // components are resolved from the top, a mismatch hides those below it
+  bool valid = error == 0;
+  for (size_t i = 0; valid && i < depth; ++i) {
+    struct inode *component = d_inode(chain[depth - 1 - i]);
+    valid = i < info->count && entry_matches(&info->entries[i], component);
+    if (valid) {
+      networkfs_inode_confirmed(component);
+    }
+  }
+
+  kfree(info);
+  kfree(path);
+  dput(base);
+  for (size_t i = 0; i < depth; ++i) {
+    dput(chain[i]);
+  }
+  if (error == -ENOENT) {
+    return 0;
+  }
+  return error < 0 ? error : valid;
+}
+
+/*
+ * Names the server reported missing stay in the dcache as negative dentries
+ * until d_time, so repeated lookups of them (PATH searches, include probing)
+ * do not reach the server. Our own create, mkdir and link turn them positive
+ * in place, changes made by other clients are seen once the TTL expires.
+ *
+ * Positive dentries are trusted for the attribute cache timeout of their
+ * inode (see struct networkfs_inode_info), then a lookup confirms them.
+ */
+int networkfs_d_revalidate(struct dentry *dentry, unsigned int flags) {
+  struct inode *inode = d_inode_rcu(dentry);
+  if (inode == NULL) {
+    // safe in RCU walk, nothing is blocked on
+    return time_before(jiffies, READ_ONCE(dentry->d_time));
+  }
+
+  struct networkfs_inode_info *info = NFS_I(inode);
+  if (time_before(jiffies,
+                  READ_ONCE(info->verified) + READ_ONCE(info->attr_timeo))) {
+    return 1;
+  }
+  if ((flags & LOOKUP_RCU) != 0) {
+    // the server can not be asked without blocking
+    return -ECHILD;
+  }
+  return dentry_verify(dentry, inode);
+}
+
+// Starts the TTL of a dentry that is or is about to become negative
+void networkfs_dentry_set_negative(struct dentry *dentry) {
+  WRITE_ONCE(dentry->d_time, jiffies + NFS_SB(dentry->d_sb)->neg_ttl);
+}
+
+/*
+ * Caches an entry listed by listplus as if it had been looked up: a missing
+ * dentry is instantiated with an inode holding the listed attributes, an
+ * existing one naming the same inode has them refreshed, and any other is
+ * dropped so that the next path walk asks the server. Called with the
+ * directory locked shared, as for lookup.
+ */
+void networkfs_dentry_prime(struct dentry *parent, const char *name,
+                            size_t len, const struct networkfs_attr *attr) {
+  struct qstr qname = QSTR_INIT(name, len);
+  qname.hash = full_name_hash(parent, name, len);
+
+  struct dentry *dentry = d_lookup(parent, &qname);
+  if (dentry == NULL) {
+    DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
+    dentry = d_alloc_parallel(parent, &qname, &wq);
+    if (IS_ERR(dentry)) {
+      return;
+    }
+  }
+
+  if (!d_in_lookup(dentry)) {
+    struct inode *inode = d_inode(dentry);
+    if (inode != NULL && inode->i_ino == attr->ino &&
+        dt_type(inode) == attr->entry_type) {
+      networkfs_inode_confirmed(inode);
+      networkfs_inode_update(inode, attr);
+    } else {
+      d_invalidate(dentry);
+    }
+    dput(dentry);
+    return;
+  }
+
+  umode_t mode = (attr->entry_type == DT_DIR) ? S_IFDIR : S_IFREG;
+  struct inode *inode =
+      networkfs_get_inode(parent->d_sb, d_inode(parent), mode, attr->ino);
+  if (inode == NULL) {
+    d_lookup_done(dentry);
+    dput(dentry);
+    return;
+  }
+  networkfs_inode_update(inode, attr);
+  struct dentry *alias = d_splice_alias(inode, dentry);
+  d_lookup_done(dentry);
+  if (!IS_ERR_OR_NULL(alias)) {
+    dput(alias);
+  }
+  dput(dentry);
+}
@@ -1,12 +1,18 @@
 #include "operations/file.h"
 
 #include <linux/dcache.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
 #include <linux/minmax.h>
+#include <linux/overflow.h>
+#include <linux/slab.h>
 #include <linux/stat.h>
 #include <linux/uaccess.h>
 #include <uapi/asm-generic/errno.h>
 
 #include "networkfs.h"
+#include "operations/dentry.h"
+#include "operations/inode.h"
 #include "remote/request.h"
 #include "util.h"
 
@@ -17,9 +23,191 @@ struct file_operations networkfs_dir_ops = {.iterate_shared = networkfs_iterate,
                                             .flush = networkfs_flush,
                                             .fsync = networkfs_fsync,
                                             .release = networkfs_release,
-                                            .llseek = generic_file_llseek};
+                                            .llseek = networkfs_llseek};
 
-void networkfs_truncate(struct file *);
+
+/*
+ * Listings are cached on the directory inode and reused by later getdents
+ * calls and other readers of the directory for the attribute cache timeout
+ * of the directory, unless our own calls or a changed ctime invalidate them.
+ * The cache holds a prefix of the listing, which grows by the pages readers
+ * ask for right after it, up to NFS_DIR_CACHE_MAX entries. Readers copy
+ * batches of it under the read lock and emit them once it is released, since
+ * dir_emit() may fault on the buffer of the caller. Received pages are added
+ * under the write lock, so the lock is never held while waiting for the
+ * server or for user memory.
+ */
+#define NFS_DIR_CACHE_BATCH 64
+
+struct dir_cache_entry {
+  struct list_head list;  // while the page is received
+  struct networkfs_attr attr;
+  u64 cookie;
+  unsigned char len;
+  char name[];
+};
+
+static bool dir_cache_fresh(struct inode *dir) {
+  struct networkfs_inode_info *info = NFS_I(dir);
+  return info->rdir.valid &&
+         time_before(jiffies,
+                     info->rdir.fetched + READ_ONCE(info->attr_timeo));
+}
+
+// Called with the write lock held, or once the inode is unused
+static void dir_cache_clear(struct networkfs_dir_cache *cache) {
+  struct dir_cache_entry *entry;
+  unsigned long index;
+  xa_for_each(&cache->entries, index, entry) {
+    kfree(entry);
+  }
+  xa_destroy(&cache->entries);
+  cache->valid = false;
+  cache->eof = false;
+  cache->end = 0;
+  cache->count = 0;
+}
+
+void networkfs_dir_cache_invalidate(struct inode *dir) {
+  struct networkfs_dir_cache *cache = &NFS_I(dir)->rdir;
+  down_write(&cache->sem);
+  dir_cache_clear(cache);
+  ++cache->gen;
+  up_write(&cache->sem);
+}
+
+void networkfs_dir_cache_drop(struct inode *dir) {
+  dir_cache_clear(&NFS_I(dir)->rdir);
+}
+
+struct iterate_state {
+  struct dir_context *ctx;
+  loff_t emitted;
+  bool stopped;  // buffer of the caller is full
+  // Entries of the page being received, emitted, primed and cached once it
+  // is complete: dir_emit() may fault on the buffer of the caller, and the
+  // others block on locks that lookups may hold while they wait for the
+  // connection the page is received over.
+  struct list_head page;
+  bool lost;  // an entry could not be kept, the page is cut short
+};
+
+static void iterate_emit(struct iterate_state *state, const char *name,
+                         size_t len, u64 cookie,
+                         const struct networkfs_attr *attr) {
+  if (state->stopped) {
+    return;
+  }
+  if (!dir_emit(state->ctx, name, len, attr->ino, attr->entry_type)) {
+    state->stopped = true;
+    return;
+  }
+  // positions past "." and ".." are cookies, the next call resumes after
+  state->ctx->pos = 2 + cookie;
+  ++state->emitted;
+}
+
+// Emits cached entries from ctx->pos, returns true if the listing ends there
+static bool dir_cache_emit(struct inode *dir, struct iterate_state *state) {
+  struct networkfs_dir_cache *cache = &NFS_I(dir)->rdir;
+  struct dir_cache_entry *entry, *next;
+  bool eof = false;
+  bool more = true;
+
+  while (more && !state->stopped) {
+    u64 cookie = state->ctx->pos - 2;
+    LIST_HEAD(batch);
+    size_t copied = 0;
+    bool cut = false;  // by the batch size or a failed copy
+
+    down_read(&cache->sem);
+    more = dir_cache_fresh(dir) && cookie <= cache->end;
+    if (more) {
+      struct dir_cache_entry *cached;
+      unsigned long index;
+      xa_for_each_start(&cache->entries, index, cached, cookie + 1) {
+        entry = NULL;
+        if (copied < NFS_DIR_CACHE_BATCH) {
+          entry = kmemdup(cached, struct_size(cached, name, cached->len + 1),
+                          GFP_KERNEL);
+        }
+        if (entry == NULL) {
+          cut = true;
+          break;
+        }
+        list_add_tail(&entry->list, &batch);
+        ++copied;
+      }
+      eof = cache->eof && !cut;
+    }
+    up_read(&cache->sem);
+
+    // a failed copy leaves the rest to the server
+    more = more && cut && copied != 0;
+    list_for_each_entry_safe(entry, next, &batch, list) {
+      iterate_emit(state, entry->name, entry->len, entry->cookie,
+                   &entry->attr);
+      kfree(entry);
+    }
+  }
+  return eof && !state->stopped;
+}
+
+// Adds entries of a received page to the cache if they continue its prefix
+static void dir_cache_fill(struct inode *dir, u64 start, unsigned long asked,
+                           u64 gen, struct list_head *page, bool eof) {
+  struct networkfs_dir_cache *cache = &NFS_I(dir)->rdir;
+  struct dir_cache_entry *entry, *next;
+
+  down_write(&cache->sem);
+  if (cache->gen == gen && start == 0 && !dir_cache_fresh(dir)) {
+    // the first page starts a new listing
+    dir_cache_clear(cache);
+    cache->valid = true;
+    cache->fetched = asked;
+  }
+  if (cache->gen == gen && cache->valid && !cache->eof &&
+      cache->end == start) {
+    list_for_each_entry_safe(entry, next, page, list) {
+      if (cache->count == NFS_DIR_CACHE_MAX ||
+          xa_insert(&cache->entries, entry->cookie, entry, GFP_KERNEL) != 0) {
+        break;
+      }
+      list_del(&entry->list);
+      cache->end = entry->cookie;
+      ++cache->count;
+    }
+    cache->eof = eof && list_empty(page);
+  }
+  up_write(&cache->sem);
+}
+
+static bool iterate_actor(void *data, const char *name, size_t len,
+                          u64 cookie, const struct networkfs_attr *attr) {
+  struct iterate_state *state = data;
+  struct dir_cache_entry *entry =
+      kmalloc(struct_size(entry, name, len + 1), GFP_KERNEL);
+  if (entry == NULL) {
+    state->lost = true;
+    return false;
+  }
+  entry->attr = *attr;
+  entry->cookie = cookie;
+  entry->len = len;
+  memcpy(entry->name, name, len);
+  entry->name[len] = '\0';
+  list_add_tail(&entry->list, &state->page);
+  return true;
+}
+
+loff_t networkfs_llseek(struct file *filp, loff_t offset, int whence) {
+  if (S_ISDIR(filp->f_inode->i_mode)) {
+    // positions of directories are cookies, not bounded by s_maxbytes
+    return generic_file_llseek_size(filp, offset, whence, MAX_LFS_FILESIZE,
+                                    i_size_read(filp->f_inode));
+  }
+  return generic_file_llseek(filp, offset, whence);
+}
 
 int networkfs_iterate(struct file *filp, struct dir_context *ctx) {
   struct dentry *dentry = filp->f_path.dentry;
@@ -42,41 +230,81 @@ int networkfs_iterate(struct file *filp, struct dir_context *ctx) {
     ++record_counter;
   }
 
-  // too big for stack allocation
-  struct networkfs_dir_entries *dir =
-      kzalloc(sizeof(struct networkfs_dir_entries), GFP_KERNEL);
+  bool plus = NFS_SB(inode->i_sb)->rdirplus;
+  struct iterate_state state = {.ctx = ctx};
+  bool eof = dir_cache_emit(inode, &state);
 
-  if (dir == NULL) {
-    printk(KERN_ERR "networkfs: iterate: response buf alloc failed\n");
-    return -ENOMEM;
+  // then pages are listed until the buffer of the caller is full
+  int error = 0;
+  while (!eof && !state.stopped) {
+    loff_t pos = ctx->pos;
+    u64 gen = READ_ONCE(NFS_I(inode)->rdir.gen);
+    unsigned long asked = jiffies;
+    INIT_LIST_HEAD(&state.page);
+    state.lost = false;
+    error = networkfs_request_iterate(filp, plus, pos - 2, &eof, iterate_actor,
+                                      &state);
+
+    struct dir_cache_entry *entry, *next;
+    if (state.lost) {
+      // entries received so far are still emitted
+      error = -ENOMEM;
+    }
+    list_for_each_entry(entry, &state.page, list) {
+      iterate_emit(&state, entry->name, entry->len, entry->cookie,
+                   &entry->attr);
+    }
+    if (error == 0 && plus) {
+      list_for_each_entry(entry, &state.page, list) {
+        networkfs_dentry_prime(dentry, entry->name, entry->len, &entry->attr);
+      }
+    }
+    if (error == 0) {
+      dir_cache_fill(inode, pos - 2, asked, gen, &state.page, eof);
+    }
+    list_for_each_entry_safe(entry, next, &state.page, list) {
+      kfree(entry);
+    }
+    if (error < 0 || ctx->pos == pos) {
+      break;  // failed, or the page was empty
+    }
   }
-  int error = networkfs_request_iterate(filp, dir);
   if (error < 0) {
-    kfree(dir);
     return error;
   }
+  return record_counter + state.emitted;
+}
 
-  size_t n_entries = dir->entries_count;
-  while (ctx->pos - 2 < n_entries) {
-    struct networkfs_dir_entry *entry = &dir->entries[ctx->pos - 2];
-    if (entry->entry_type == 0) {
-      break;
-    }
-    if (!dir_emit(ctx, wstr(entry->name), entry->ino, entry->entry_type)) {
-      kfree(dir);
-      return record_counter;
-    }
-    ++ctx->pos;
-    ++record_counter;
-  }
-  kfree(dir);
-  return record_counter;
+/*
+ * private_data of an open file is its content, preceded by the size of the
+ * content as in the layout of networkfs_request_read(). Reads and write back
+ * are bounded by that size rather than by i_size, which a getattr or another
+ * open of the inode may set beyond what this file holds.
+ */
+static u64 *file_size(struct file *filp) {
+  return filp->private_data - sizeof(u64);
 }
 
-void networkfs_truncate(struct file *filp) {
+void networkfs_file_set_size(struct file *filp, loff_t size) {
   char *file_content = filp->private_data;
-  loff_t file_size = filp->f_inode->i_size;
-  memset(file_content + file_size, 0, NFS_MAXSZ - file_size);
+  u64 *held = file_size(filp);
+  if (size > *held) {
+    // stale bytes past the content are not exposed by a growing truncate
+    memset(file_content + *held, 0, size - *held);
+  }
+  *held = size;
+  i_size_write(filp->f_inode, size);
+}
+
+// Takes @buf with the content in the layout of networkfs_request_read()
+static void open_content(struct inode *inode, struct file *filp, void *buf) {
+  void *file_content = buf + sizeof(u64);
+  filp->private_data = file_content;
+  atomic_inc(&NFS_I(inode)->open_files);
+  inode->i_size = *(u64 *)(buf);
+  if ((filp->f_flags & O_APPEND) == O_APPEND) {
+    generic_file_llseek(filp, 0, SEEK_END);
+  }
 }
 
 int networkfs_open(struct inode *inode, struct file *filp) {
@@ -86,7 +314,7 @@ int networkfs_open(struct inode *inode, struct file *filp) {
     return 0;
   }
   size_t buf_size = NFS_MAXSZ + sizeof(u64);
-  void *buf = kmalloc(buf_size, GFP_KERNEL);
+  void *buf = kzalloc(buf_size, GFP_KERNEL);
   if (buf == NULL) {
     printk(KERN_ERR "networkfs: open: response buf alloc failed\n");
     return -ENOMEM;
@@ -97,13 +325,12 @@ int networkfs_open(struct inode *inode, struct file *filp) {
     return error;
   }
 
-  void *file_content = buf + sizeof(u64);
-  filp->private_data = file_content;
-  inode->i_size = *(u64 *)(buf);
-  if ((filp->f_flags & O_APPEND) == O_APPEND) {
-    generic_file_llseek(filp, 0, SEEK_END);
-  }
+  open_content(inode, filp, buf);
+  return 0;
+}
 
+int networkfs_open_prefetched(struct inode *inode, struct file *filp) {
+  open_content(inode, filp, filp->private_data);
   return 0;
 }
 
@@ -115,15 +342,12 @@ ssize_t networkfs_read(struct file *filp, char *buffer, size_t len,
   }
   size_t from = *offset;
   char *file_content = filp->private_data;
-  loff_t file_size = filp->f_inode->i_size;
+  u64 size = *file_size(filp);
 
-  if (from > file_size) {
-    printk(KERN_ERR
-           "networkfs: read: invalid offset (%ld) in file %lu of size %lld\n",
-           from, filp->f_inode->i_ino, file_size);
-    return -EIO;
+  if (from >= size) {
+    return 0;  // e.g. i_size has grown past the content held
   }
-  len = min(len, file_size - from);
+  len = min(len, size - from);
   size_t copied = len - copy_to_user(buffer, file_content + from, len);
   *offset += copied;
   return copied;
@@ -143,33 +367,47 @@ ssize_t networkfs_write(struct file *filp, const char *buffer, size_t len,
     return -EDQUOT;
   }
   len = min(len, NFS_MAXSZ - from);
+  u64 *size = file_size(filp);
+  if (from > *size) {
+    // the gap reads as zeroes
+    memset(file_content + *size, 0, from - *size);
+  }
   size_t copied = len - copy_from_user(file_content + from, buffer, len);
-  size_t file_size = filp->f_inode->i_size;
-  file_size = max(file_size, from + copied);
-  filp->f_inode->i_size = file_size;
+  *size = max_t(u64, *size, from + copied);
+  i_size_write(filp->f_inode, *size);
   *offset += copied;
   return copied;
 }
 
+// Writes the content back, the server then has new mtime and ctime
+static int file_write_back(struct file *filp) {
+  int error = networkfs_request_write(filp, *file_size(filp));
+  if (error == 0) {
+    networkfs_inode_invalidate_attr(filp->f_inode);
+  }
+  return error;
+}
+
 int networkfs_flush(struct file *filp, fl_owner_t id) {
   if (S_ISDIR(filp->f_inode->i_mode)) {
     return 0;
   }
-  return networkfs_request_write(filp, filp->f_inode->i_size);
+  return file_write_back(filp);
 }
 
 int networkfs_fsync(struct file *filp, loff_t begin, loff_t end, int datasync) {
   if (S_ISDIR(filp->f_inode->i_mode)) {
     return 0;
   }
-  return networkfs_request_write(filp, filp->f_inode->i_size);
+  return file_write_back(filp);
 }
 
 int networkfs_release(struct inode *inode, struct file *filp) {
   if (S_ISDIR(filp->f_inode->i_mode)) {
     return 0;
   }
-  kfree(filp->private_data - sizeof(u64));
+  kfree(file_size(filp));
+  atomic_dec(&NFS_I(inode)->open_files);
 
   return 0;
 }
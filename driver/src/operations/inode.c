@@ -1,9 +1,14 @@
 #include "operations/inode.h"
 
 #include <linux/dcache.h>
+#include <linux/jiffies.h>
+#include <linux/minmax.h>
+#include <linux/mount.h>
+#include <linux/slab.h>
 #include <linux/stat.h>
 
 #include "networkfs.h"
+#include "operations/dentry.h"
 #include "operations/file.h"
 #include "remote/request.h"
 #include "util.h"
@@ -14,24 +19,161 @@ struct inode_operations networkfs_inode_ops = {.lookup = networkfs_lookup,
                                                .mkdir = networkfs_mkdir,
                                                .rmdir = networkfs_rmdir,
                                                .setattr = networkfs_setattr,
-                                               .link = networkfs_link};
+                                               .getattr = networkfs_getattr,
+                                               .link = networkfs_link,
+                                               .atomic_open =
+                                                   networkfs_atomic_open};
 
+static struct kmem_cache *networkfs_inode_cachep;
+
+static void networkfs_inode_init_once(void *data) {
+  struct networkfs_inode_info *info = data;
+  inode_init_once(&info->vfs_inode);
+  init_rwsem(&info->rdir.sem);
+  xa_init(&info->rdir.entries);
+}
+
+int networkfs_inode_cache_init(void) {
+  networkfs_inode_cachep = kmem_cache_create(
+      "networkfs_inode_cache", sizeof(struct networkfs_inode_info), 0,
+      SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, networkfs_inode_init_once);
+  return networkfs_inode_cachep != NULL ? 0 : -ENOMEM;
+}
+
+void networkfs_inode_cache_destroy(void) {
+  // inodes are freed after an RCU grace period
+  rcu_barrier();
+  kmem_cache_destroy(networkfs_inode_cachep);
+}
+
+struct inode *networkfs_alloc_inode(struct super_block *sb) {
+  struct networkfs_inode_info *info =
+      alloc_inode_sb(sb, networkfs_inode_cachep, GFP_KERNEL);
+  if (info == NULL) {
+    return NULL;
+  }
+  info->verified = jiffies;
+  info->attr_timeo = 0;
+  info->attr_valid = false;
+  atomic_set(&info->open_files, 0);
+  info->rdir.valid = false;
+  return &info->vfs_inode;
+}
+
+// Called right on eviction, the listing is not needed by RCU walkers
+void networkfs_destroy_inode(struct inode *inode) {
+  networkfs_dir_cache_drop(inode);
+}
+
+void networkfs_free_inode(struct inode *inode) {
+  kmem_cache_free(networkfs_inode_cachep, NFS_I(inode));
+}
+
+// Key of the inode cache: server inode number and file type
+struct inode_key {
+  ino_t ino;
+  umode_t mode;
+};
+
+static int inode_test(struct inode *inode, void *data) {
+  const struct inode_key *key = data;
+  // a stale inode of another type is never reused for the number
+  return inode->i_ino == key->ino && !inode_wrong_type(inode, key->mode);
+}
+
+static int inode_set(struct inode *inode, void *data) {
+  const struct inode_key *key = data;
+  inode->i_ino = key->ino;
+  return 0;
+}
+
+/*
+ * Inodes are hashed by server inode number, so hard links share a single
+ * inode with its attributes, and a name looked up again after its dentry was
+ * evicted reuses the inode while it is still cached. Contents are not shared:
+ * every open file holds the copy it read (see operations/file.c).
+ */
 struct inode *networkfs_get_inode(struct super_block *sb,
                                   const struct inode *parent, umode_t mode,
-                                  int i_ino) {
-  struct inode *inode;
-  inode = new_inode(sb);
+                                  ino_t ino) {
+  struct networkfs_sb_info *sbi = NFS_SB(sb);
+  struct inode_key key = {.ino = ino, .mode = mode};
+  struct inode *inode = iget5_locked(sb, ino, inode_test, inode_set, &key);
 
-  if (inode != NULL) {
-    inode->i_op = &networkfs_inode_ops;
-    inode->i_fop = &networkfs_dir_ops;
-    inode->i_ino = i_ino;
-    inode_init_owner(&nop_mnt_idmap, inode, parent, mode | NFS_PERM);
+  if (inode == NULL) {
+    return NULL;
+  }
+  if ((inode->i_state & I_NEW) == 0) {
+    // the server has just reported the entry
+    networkfs_inode_confirmed(inode);
+    return inode;
   }
 
+  inode->i_op = &networkfs_inode_ops;
+  inode->i_fop = &networkfs_dir_ops;
+  inode_init_owner(&nop_mnt_idmap, inode, parent, mode | NFS_PERM);
+  NFS_I(inode)->attr_timeo = S_ISDIR(mode) ? sbi->acdirmin : sbi->acregmin;
+  unlock_new_inode(inode);
   return inode;
 }
 
+// Cache period that follows attr_timeo, doubled or reset to ac*min
+static unsigned long inode_next_timeo(struct inode *inode, bool changed) {
+  struct networkfs_sb_info *sbi = NFS_SB(inode->i_sb);
+  bool dir = S_ISDIR(inode->i_mode);
+  unsigned long lo = dir ? sbi->acdirmin : sbi->acregmin;
+  unsigned long hi = dir ? sbi->acdirmax : sbi->acregmax;
+
+  return changed ? lo : clamp(2 * READ_ONCE(NFS_I(inode)->attr_timeo), lo, hi);
+}
+
+// Server confirmed the entry unchanged, so it is trusted twice as long
+void networkfs_inode_confirmed(struct inode *inode) {
+  struct networkfs_inode_info *info = NFS_I(inode);
+  WRITE_ONCE(info->attr_timeo, inode_next_timeo(inode, false));
+  WRITE_ONCE(info->verified, jiffies);
+}
+
+// Applies attributes fetched from the server
+void networkfs_inode_update(struct inode *inode,
+                            const struct networkfs_attr *attr) {
+  struct networkfs_inode_info *info = NFS_I(inode);
+  struct timespec64 ctime = ns_to_timespec64(attr->ctime);
+  struct timespec64 cached_ctime = inode_get_ctime(inode);
+  bool known = READ_ONCE(info->attr_valid);
+  bool changed = !known || !timespec64_equal(&ctime, &cached_ctime);
+
+  if (S_ISDIR(inode->i_mode) && known && changed) {
+    // entries were added or removed, possibly by another client
+    networkfs_dir_cache_invalidate(inode);
+  }
+
+  inode_set_mtime_to_ts(inode, ns_to_timespec64(attr->mtime));
+  inode_set_ctime_to_ts(inode, ctime);
+  set_nlink(inode, attr->nlink);
+  if (atomic_read(&info->open_files) == 0) {
+    // otherwise the size of the content read at open or of unflushed writes
+    // is kept, whether fetched by getattr or listed by listplus
+    i_size_write(inode, attr->size);
+  }
+
+  WRITE_ONCE(info->attr_timeo, inode_next_timeo(inode, changed));
+  WRITE_ONCE(info->attr_fetched, jiffies);
+  WRITE_ONCE(info->attr_valid, true);
+}
+
+// Attributes are known to have changed on the server, e.g. by our own call
+void networkfs_inode_invalidate_attr(struct inode *inode) {
+  WRITE_ONCE(NFS_I(inode)->attr_valid, false);
+}
+
+static bool inode_attr_fresh(struct inode *inode) {
+  struct networkfs_inode_info *info = NFS_I(inode);
+  return READ_ONCE(info->attr_valid) &&
+         time_before(jiffies, READ_ONCE(info->attr_fetched) +
+                                  READ_ONCE(info->attr_timeo));
+}
+
 int networkfs_mkdir(struct mnt_idmap *idmap, struct inode *parent,
                     struct dentry *child, umode_t mode) {
   ino_t new_ino;
@@ -40,22 +182,65 @@ int networkfs_mkdir(struct mnt_idmap *idmap, struct inode *parent,
   if (error < 0) {
     return error;
   }
+  networkfs_dir_cache_invalidate(parent);
 
   struct inode *inode =
       networkfs_get_inode(parent->i_sb, parent, S_IFDIR | mode, new_ino);
   if (inode == NULL) {
     return -ENOMEM;
   }
-  d_add(child, inode);
+  // child is a hashed negative dentry left by lookup
+  d_instantiate(child, inode);
+  return 0;
+}
+
+/*
+ * Attributes are served from the cache while it is fresh, so `ls -l` and
+ * repeated stat() calls do not reach the server. AT_STATX_FORCE_SYNC and
+ * AT_STATX_DONT_SYNC bypass the timeout either way.
+ */
+int networkfs_getattr(struct mnt_idmap *idmap, const struct path *path,
+                      struct kstat *stat, u32 request_mask,
+                      unsigned int flags) {
+  struct inode *inode = d_inode(path->dentry);
+  unsigned int sync = flags & AT_STATX_SYNC_TYPE;
+
+  if (sync == AT_STATX_FORCE_SYNC ||
+      (sync != AT_STATX_DONT_SYNC && !inode_attr_fresh(inode))) {
+    struct networkfs_attr attr;
+    int error = networkfs_request_getattr(inode, &attr);
+    if (error < 0) {
+      return error;
+    }
+    if (attr.ino != inode->i_ino || attr.entry_type != dt_type(inode)) {
+      return -ESTALE;
+    }
+    networkfs_inode_update(inode, &attr);
+  }
+
+  generic_fillattr(idmap, request_mask, inode, stat);
   return 0;
 }
 
 int networkfs_rmdir(struct inode *parent, struct dentry *child) {
-  return networkfs_request_rmdir(parent, child);
+  int error = networkfs_request_rmdir(parent, child);
+  if (error == 0) {
+    // VFS leaves the dentry negative, the name is known to be missing
+    networkfs_dentry_set_negative(child);
+    networkfs_dir_cache_invalidate(parent);
+  }
+  return error;
 }
 
 int networkfs_unlink(struct inode *parent, struct dentry *child) {
-  return networkfs_request_unlink(parent, child);
+  int error = networkfs_request_unlink(parent, child);
+  if (error == 0) {
+    networkfs_dentry_set_negative(child);
+    networkfs_dir_cache_invalidate(parent);
+    // link count of the inode dropped
+    networkfs_inode_invalidate_attr(d_inode(child));
+  }
+  return error;
 }
 
 int networkfs_create(struct mnt_idmap *idmap, struct inode *parent,
@@ -65,6 +250,7 @@ int networkfs_create(struct mnt_idmap *idmap, struct inode *parent,
   if (error < 0) {
     return error;
   }
+  networkfs_dir_cache_invalidate(parent);
 
   struct inode *inode =
       networkfs_get_inode(parent->i_sb, parent, S_IFREG | mode, new_ino);
@@ -72,26 +258,116 @@ int networkfs_create(struct mnt_idmap *idmap, struct inode *parent,
     printk(KERN_ERR "networkfs: create: inode alloc failed\n");
     return -ENOMEM;
   }
-  d_add(child, inode);
+  d_instantiate(child, inode);
   return 0;
 }
 
-struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
-                                unsigned int flag) {
-  struct networkfs_entry_info entry;
-  int error = networkfs_request_lookup(parent, child, &entry);
+// Adds @child to the dcache once its lookup returned @error and @entry
+static struct dentry *lookup_finish(struct inode *parent, struct dentry *child,
+                                    int error,
+                                    const struct networkfs_entry_info *entry) {
+  if (error == -ENOENT) {
+    networkfs_dentry_set_negative(child);
+    return d_splice_alias(NULL, child);
+  }
   if (error < 0) {
-    return NULL;
+    return ERR_PTR(error);
   }
-  umode_t mode = (entry.entry_type == DT_DIR) ? S_IFDIR : S_IFREG;
+  umode_t mode = (entry->entry_type == DT_DIR) ? S_IFDIR : S_IFREG;
   struct inode *inode =
-      networkfs_get_inode(parent->i_sb, parent, mode, entry.ino);
+      networkfs_get_inode(parent->i_sb, parent, mode, entry->ino);
   if (inode == NULL) {
     printk(KERN_ERR "networkfs: lookup: inode alloc failed\n");
-    return NULL;
+    return ERR_PTR(-ENOMEM);
+  }
+  // a directory may already have a dentry elsewhere, that one is kept
+  return d_splice_alias(inode, child);
+}
+
+struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
+                                unsigned int flag) {
+  struct networkfs_entry_info entry;
+  int error = networkfs_request_lookup(parent, child, &entry);
+  return lookup_finish(parent, child, error, &entry);
+}
+
+/*
+ * Opening a name that is not in the dcache looks it up and reads the file in
+ * a single compound call, where a lookup and then the read of networkfs_open()
+ * would take two. O_TRUNC opens empty the file with a write in the same call
+ * instead, so `>` redirection to an existing file takes one call up to the
+ * write back. O_PATH opens nothing, and O_WRONLY opens without O_TRUNC are
+ * left to the usual open path. A name created here is known to be empty, it
+ * is not read at all.
+ */
+int networkfs_atomic_open(struct inode *parent, struct dentry *child,
+                          struct file *filp, unsigned int flags,
+                          umode_t mode) {
+  size_t buf_size = NFS_MAXSZ + sizeof(u64);
+  struct dentry *res = NULL;
+  void *buf = NULL;
+  bool read = false;
+  int error;
+
+  // an existing file is not opened with O_EXCL, so it is not read either;
+  // a read-only mount fails the open afterwards, so files are not emptied
+  bool trunc = (flags & O_TRUNC) != 0;
+  bool prefetch = (flags & (O_PATH | O_EXCL)) == 0 &&
+                  (trunc ? !__mnt_is_readonly(filp->f_path.mnt)
+                         : (flags & O_ACCMODE) != O_WRONLY);
+  if (d_in_lookup(child) && NFS_SB(parent->i_sb)->vers == NFS_WIRE_PACKED &&
+      prefetch) {
+    struct networkfs_entry_info entry;
+    buf = kzalloc(buf_size, GFP_KERNEL);
+    if (buf == NULL) {
+      return -ENOMEM;
+    }
+    error = networkfs_request_open(parent, child, trunc, &entry, buf, buf_size);
+    res = lookup_finish(parent, child, error, &entry);
+    if (IS_ERR(res)) {
+      kfree(buf);
+      return PTR_ERR(res);
+    }
+    read = error == 0 && entry.entry_type != DT_DIR;
+    if (read && trunc) {
+      networkfs_inode_invalidate_attr(d_inode(res != NULL ? res : child));
+    }
+  } else if (d_in_lookup(child)) {
+    res = networkfs_lookup(parent, child, 0);
+    if (IS_ERR(res)) {
+      return PTR_ERR(res);
+    }
   }
-  d_add(child, inode);
-  return NULL;
+  if (res != NULL) {
+    child = res;
+  }
+
+  if (d_really_is_negative(child) && (flags & O_CREAT) != 0) {
+    if (buf == NULL && (buf = kzalloc(buf_size, GFP_KERNEL)) == NULL) {
+      return -ENOMEM;
+    }
+    error = networkfs_create(&nop_mnt_idmap, parent, child, mode,
+                             (flags & O_EXCL) != 0);
+    if (error < 0) {
+      kfree(buf);
+      return error;
+    }
+    filp->f_mode |= FMODE_CREATED;
+    *(u64 *)buf = 0;
+    read = true;
+  }
+
+  if (!read) {
+    kfree(buf);
+    return finish_no_open(filp, res);
+  }
+  filp->private_data = buf;  // taken by networkfs_open_prefetched()
+  error = finish_open(filp, child, networkfs_open_prefetched);
+  if (error < 0 && (filp->f_mode & FMODE_OPENED) == 0) {
+    kfree(buf);
+  }
+  dput(res);
+  return error;
 }
 
 int networkfs_setattr(struct mnt_idmap *idmap, struct dentry *entry,
@@ -100,7 +376,10 @@ int networkfs_setattr(struct mnt_idmap *idmap, struct dentry *entry,
   if (error < 0) {
     return error;
   }
-  if (attr->ia_valid & ATTR_OPEN) {
+  if ((attr->ia_valid & ATTR_SIZE) != 0 && (attr->ia_valid & ATTR_FILE) != 0 &&
+      attr->ia_file->private_data != NULL) {
+    networkfs_file_set_size(attr->ia_file, attr->ia_size);
+  } else if (attr->ia_valid & ATTR_OPEN) {
     entry->d_inode->i_size = attr->ia_size;
   }
 
@@ -109,5 +388,16 @@ int networkfs_setattr(struct mnt_idmap *idmap, struct dentry *entry,
 
 int networkfs_link(struct dentry *target, struct inode *parent,
                    struct dentry *child) {
-  return networkfs_request_link(target, parent, child);
+  int error = networkfs_request_link(target, parent, child);
+  if (error < 0) {
+    return error;
+  }
+  networkfs_dir_cache_invalidate(parent);
+
+  // the new name may be cached as missing, it now refers to the target
+  struct inode *inode = d_inode(target);
+  networkfs_inode_invalidate_attr(inode);
+  ihold(inode);
+  d_instantiate(child, inode);
+  return 0;
 }
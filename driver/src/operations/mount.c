@@ -1,18 +1,51 @@
 #include "operations/mount.h"
 
+#include <linux/cpumask.h>
 #include <linux/fs_context.h>
+#include <linux/fs_parser.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/un.h>
 
 #include "networkfs.h"
+#include "operations/dentry.h"
 #include "operations/inode.h"
+#include "remote/rpc.h"
+
+struct super_operations networkfs_super_ops = {
+    .alloc_inode = networkfs_alloc_inode,
+    .destroy_inode = networkfs_destroy_inode,
+    .free_inode = networkfs_free_inode};
 
 int networkfs_fill_super(struct super_block *sb, struct fs_context *fc) {
+  struct networkfs_mount_options *opts = fc->fs_private;
+
   sb->s_maxbytes = NFS_MAXSZ;
-  char *token = kzalloc(strlen(fc->source) + 1, GFP_KERNEL);
-  if (token == NULL) {
+  sb->s_op = &networkfs_super_ops;
+  struct networkfs_sb_info *sbi =
+      kzalloc(sizeof(struct networkfs_sb_info), GFP_KERNEL);
+  if (sbi == NULL) {
     return -ENOMEM;
   }
-  memcpy(token, fc->source, strlen(fc->source));
-  sb->s_fs_info = token;
+  sb->s_fs_info = sbi;
+
+  sbi->token = kzalloc(strlen(fc->source) + 1, GFP_KERNEL);
+  if (sbi->token == NULL) {
+    return -ENOMEM;
+  }
+  memcpy(sbi->token, fc->source, strlen(fc->source));
+
+  int error = networkfs_rpc_init(sbi, opts);
+  if (error != 0) {
+    return error;
+  }
+  sbi->neg_ttl = opts->negttl * HZ;
+  sbi->acregmin = opts->acregmin * HZ;
+  sbi->acregmax = opts->acregmax * HZ;
+  sbi->acdirmin = opts->acdirmin * HZ;
+  sbi->acdirmax = opts->acdirmax * HZ;
+  sbi->rdirplus = opts->rdirplus;
+  sb->s_d_op = &networkfs_dentry_ops;
 
   struct inode *inode = networkfs_get_inode(sb, NULL, S_IFDIR, NFS_ROOT);
   if (inode == NULL) {
@@ -28,6 +61,14 @@ int networkfs_fill_super(struct super_block *sb, struct fs_context *fc) {
 }
 
 int networkfs_get_tree(struct fs_context *fc) {
+  struct networkfs_mount_options *opts = fc->fs_private;
+  if (fc->source == NULL) {
+    return invalfc(fc, "token is not specified");
+  }
+  if (opts->acregmin > opts->acregmax || opts->acdirmin > opts->acdirmax) {
+    return invalfc(fc, "ac*min can not exceed ac*max");
+  }
+
   int ret = get_tree_nodev(fc, networkfs_fill_super);
 
   if (ret != 0) {
@@ -40,17 +81,252 @@ int networkfs_get_tree(struct fs_context *fc) {
 }
 
 void networkfs_kill_sb(struct super_block *sb) {
+  struct networkfs_sb_info *sbi = NFS_SB(sb);
+
+  kill_anon_super(sb);
+  if (sbi == NULL) {
+    return;
+  }
+
   printk(KERN_INFO "networkfs: superblock is destroyed; token: %s\n",
-         (char *)sb->s_fs_info);
-  kfree(sb->s_fs_info);
+         sbi->token);
+  networkfs_rpc_destroy(sbi);
+  kfree(sbi->token);
+  kfree(sbi);
 }
 
 // File system context
 
-struct fs_context_operations networkfs_context_ops = {.get_tree =
-                                                          networkfs_get_tree};
+enum networkfs_param {
+  Opt_pool_size,
+  Opt_pipeline,
+  Opt_host,
+  Opt_port,
+  Opt_unix,
+  Opt_timeo,
+  Opt_retrans,
+  Opt_hedge,
+  Opt_nodelay,
+  Opt_sndbuf,
+  Opt_rcvbuf,
+  Opt_busy_poll,
+  Opt_rx_cpu,
+  Opt_compress,
+  Opt_vers,
+  Opt_negttl,
+  Opt_acregmin,
+  Opt_acregmax,
+  Opt_acdirmin,
+  Opt_acdirmax,
+  Opt_actimeo,
+  Opt_rdirplus,
+};
+
+static const struct fs_parameter_spec networkfs_fs_parameters[] = {
+    fsparam_u32("pool_size", Opt_pool_size),
+    fsparam_u32("pipeline", Opt_pipeline),
+    fsparam_string("host", Opt_host),
+    fsparam_u32("port", Opt_port),
+    fsparam_string("unix", Opt_unix),
+    fsparam_u32("timeo", Opt_timeo),
+    fsparam_u32("retrans", Opt_retrans),
+    fsparam_flag_no("hedge", Opt_hedge),
+    fsparam_flag_no("nodelay", Opt_nodelay),
+    fsparam_u32("sndbuf", Opt_sndbuf),
+    fsparam_u32("rcvbuf", Opt_rcvbuf),
+    fsparam_u32("busy_poll", Opt_busy_poll),
+    fsparam_u32("rx_cpu", Opt_rx_cpu),
+    fsparam_flag_no("compress", Opt_compress),
+    fsparam_u32("vers", Opt_vers),
+    fsparam_u32("negttl", Opt_negttl),
+    fsparam_u32("acregmin", Opt_acregmin),
+    fsparam_u32("acregmax", Opt_acregmax),
+    fsparam_u32("acdirmin", Opt_acdirmin),
+    fsparam_u32("acdirmax", Opt_acdirmax),
+    fsparam_u32("actimeo", Opt_actimeo),
+    fsparam_flag_no("rdirplus", Opt_rdirplus), {}};
+
+int networkfs_parse_param(struct fs_context *fc, struct fs_parameter *param) {
+  struct networkfs_mount_options *opts = fc->fs_private;
+  struct sockaddr_in *inet = (struct sockaddr_in *)&opts->endpoint.addr;
+  struct sockaddr_un *local = (struct sockaddr_un *)&opts->endpoint.addr;
+  struct fs_parse_result result;
+
+  int opt = fs_parse(fc, networkfs_fs_parameters, param, &result);
+  if (opt < 0) {
+    // -ENOPARAM lets VFS handle "source", which carries the token
+    return opt;
+  }
+
+  switch (opt) {
+    case Opt_pool_size:
+      if (result.uint_32 == 0 || result.uint_32 > NFS_POOL_MAX) {
+        return invalfc(fc, "pool_size must be in [1, %d]",
+                       NFS_POOL_MAX);
+      }
+      opts->pool_size = result.uint_32;
+      break;
+    case Opt_pipeline:
+      if (result.uint_32 == 0 || result.uint_32 > NFS_PIPELINE_MAX) {
+        return invalfc(fc, "pipeline must be in [1, %d]", NFS_PIPELINE_MAX);
+      }
+      opts->pipeline = result.uint_32;
+      break;
+    case Opt_host:
+    case Opt_port:
+      if (opts->endpoint.addr.ss_family != AF_INET) {
+        return invalfc(fc, "%s can not be used with unix", param->key);
+      }
+      opts->inet_set = true;
+      if (opt == Opt_port) {
+        if (result.uint_32 == 0 || result.uint_32 > U16_MAX) {
+          return invalfc(fc, "port must be in [1, %d]", U16_MAX);
+        }
+        inet->sin_port = htons(result.uint_32);
+      } else if (in4_pton(param->string, -1, (u8 *)&inet->sin_addr.s_addr,
+                          -1, NULL) == 0) {
+        return invalfc(fc, "host must be an IPv4 address");
+      }
+      break;
+    case Opt_unix:
+      if (opts->inet_set) {
+        return invalfc(fc, "unix can not be used with host and port");
+      }
+      size_t len = strlen(param->string);
+      if (len == 0 || len >= sizeof(local->sun_path)) {
+        return invalfc(fc, "unix path must be 1 to %zu characters long",
+                       sizeof(local->sun_path) - 1);
+      }
+      memset(&opts->endpoint.addr, 0, sizeof(opts->endpoint.addr));
+      local->sun_family = AF_UNIX;
+      memcpy(local->sun_path, param->string, len);
+      opts->endpoint.addrlen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+      break;
+    case Opt_timeo:
+      if (result.uint_32 == 0 || result.uint_32 > NFS_TIMEO_MAX) {
+        return invalfc(fc, "timeo must be in [1, %d]", NFS_TIMEO_MAX);
+      }
+      opts->timeo = result.uint_32;
+      break;
+    case Opt_retrans:
+      if (result.uint_32 > NFS_RETRANS_MAX) {
+        return invalfc(fc, "retrans must be in [0, %d]", NFS_RETRANS_MAX);
+      }
+      opts->retrans = result.uint_32;
+      break;
+    case Opt_hedge:
+      opts->hedge = !result.negated;
+      break;
+    case Opt_nodelay:
+      opts->sock_opts.nodelay = !result.negated;
+      break;
+    case Opt_sndbuf:
+    case Opt_rcvbuf:
+      if (result.uint_32 > NFS_SOCKBUF_MAX) {
+        return invalfc(fc, "%s must be at most %d", param->key,
+                       NFS_SOCKBUF_MAX);
+      }
+      if (opt == Opt_sndbuf) {
+        opts->sock_opts.sndbuf = result.uint_32;
+      } else {
+        opts->sock_opts.rcvbuf = result.uint_32;
+      }
+      break;
+    case Opt_busy_poll:
+      if (result.uint_32 > NFS_BUSY_POLL_MAX) {
+        return invalfc(fc, "busy_poll must be at most %d",
+                       NFS_BUSY_POLL_MAX);
+      }
+      opts->sock_opts.busy_poll = result.uint_32;
+      break;
+    case Opt_rx_cpu:
+      if (result.uint_32 >= nr_cpu_ids || !cpu_possible(result.uint_32)) {
+        return invalfc(fc, "rx_cpu must be a possible CPU");
+      }
+      opts->rx_cpu = result.uint_32;
+      break;
+    case Opt_compress:
+      opts->compress = !result.negated;
+      break;
+    case Opt_vers:
+      if (result.uint_32 != NFS_WIRE_LEGACY &&
+          result.uint_32 != NFS_WIRE_PACKED) {
+        return invalfc(fc, "vers must be %d or %d", NFS_WIRE_LEGACY,
+                       NFS_WIRE_PACKED);
+      }
+      opts->vers = result.uint_32;
+      break;
+    case Opt_negttl:
+      if (result.uint_32 > NFS_NEGTTL_MAX) {
+        return invalfc(fc, "negttl must be at most %d", NFS_NEGTTL_MAX);
+      }
+      opts->negttl = result.uint_32;
+      break;
+    case Opt_acregmin:
+    case Opt_acregmax:
+    case Opt_acdirmin:
+    case Opt_acdirmax:
+    case Opt_actimeo:
+      if (result.uint_32 > NFS_ACTIMEO_MAX) {
+        return invalfc(fc, "%s must be at most %d", param->key,
+                       NFS_ACTIMEO_MAX);
+      }
+      if (opt == Opt_acregmin || opt == Opt_actimeo) {
+        opts->acregmin = result.uint_32;
+      }
+      if (opt == Opt_acregmax || opt == Opt_actimeo) {
+        opts->acregmax = result.uint_32;
+      }
+      if (opt == Opt_acdirmin || opt == Opt_actimeo) {
+        opts->acdirmin = result.uint_32;
+      }
+      if (opt == Opt_acdirmax || opt == Opt_actimeo) {
+        opts->acdirmax = result.uint_32;
+      }
+      break;
+    case Opt_rdirplus:
+      opts->rdirplus = !result.negated;
+      break;
+  }
+
+  return 0;
+}
+
+void networkfs_free_fc(struct fs_context *fc) { kfree(fc->fs_private); }
+
+struct fs_context_operations networkfs_context_ops = {
+    .parse_param = networkfs_parse_param,
+    .get_tree = networkfs_get_tree,
+    .free = networkfs_free_fc};
 
 int networkfs_init_fs_context(struct fs_context *fc) {
+  struct networkfs_mount_options *opts =
+      kzalloc(sizeof(struct networkfs_mount_options), GFP_KERNEL);
+  if (opts == NULL) {
+    return -ENOMEM;
+  }
+  opts->pool_size = NFS_POOL_DEFAULT;
+  opts->pipeline = NFS_PIPELINE_DEFAULT;
+  opts->timeo = NFS_TIMEO_DEFAULT;
+  opts->retrans = NFS_RETRANS_DEFAULT;
+  opts->compress = true;
+  opts->vers = NFS_WIRE_PACKED;
+  opts->negttl = NFS_NEGTTL_DEFAULT;
+  opts->acregmin = NFS_ACREGMIN_DEFAULT;
+  opts->acregmax = NFS_ACREGMAX_DEFAULT;
+  opts->acdirmin = NFS_ACDIRMIN_DEFAULT;
+  opts->acdirmax = NFS_ACDIRMAX_DEFAULT;
+  opts->rdirplus = true;
+  opts->sock_opts.nodelay = true;
+  opts->rx_cpu = -1;
+
+  struct sockaddr_in *inet = (struct sockaddr_in *)&opts->endpoint.addr;
+  inet->sin_family = AF_INET;
+  inet->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  inet->sin_port = htons(NFS_PORT_DEFAULT);
+  opts->endpoint.addrlen = sizeof(struct sockaddr_in);
+
+  fc->fs_private = opts;
   fc->ops = &networkfs_context_ops;
   return 0;
 }
@@ -0,0 +1,317 @@
+#include "remote/connection.h"
+
+#include <linux/in.h>
+#include <linux/slab.h>
+#include <net/busy_poll.h>
+#include <net/sock.h>
+#include <net/tcp.h>
+#include <net/tcp_states.h>
+
+#include "remote/http.h"
+
+static void conn_close(struct networkfs_conn *conn) {
+  // only abandoned turns may be left, nobody waits for their responses
+  struct networkfs_conn_turn *turn, *next;
+  list_for_each_entry_safe(turn, next, &conn->queue, node) {
+    list_del(&turn->node);
+    kfree(turn);
+  }
+  conn->draining = false;
+
+  if (conn->sock == NULL) {
+    return;
+  }
+  kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+  sock_release(conn->sock);
+  conn->sock = NULL;
+  conn->eof = false;
+  conn->rbuf_start = conn->rbuf_end = 0;
+}
+
+int networkfs_pool_init(struct networkfs_conn_pool *pool,
+                        const struct networkfs_endpoint *endpoint,
+                        const struct networkfs_sock_opts *sock_opts,
+                        size_t size, unsigned int depth) {
+  pool->conns = kcalloc(size, sizeof(struct networkfs_conn), GFP_KERNEL);
+  if (pool->conns == NULL) {
+    return -ENOMEM;
+  }
+  pool->endpoint = *endpoint;
+  pool->sock_opts = *sock_opts;
+  pool->size = size;
+  pool->depth = depth;
+  spin_lock_init(&pool->lock);
+  init_waitqueue_head(&pool->wait);
+
+  for (size_t i = 0; i < size; ++i) {
+    struct networkfs_conn *conn = &pool->conns[i];
+    conn->pool = pool;
+    mutex_init(&conn->send_lock);
+    spin_lock_init(&conn->queue_lock);
+    INIT_LIST_HEAD(&conn->queue);
+    init_waitqueue_head(&conn->turn);
+  }
+  return 0;
+}
+
+void networkfs_pool_destroy(struct networkfs_conn_pool *pool) {
+  if (pool->conns == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < pool->size; ++i) {
+    conn_close(&pool->conns[i]);
+  }
+  kfree(pool->conns);
+  pool->conns = NULL;
+}
+
+// Lower is better: idle connected socket, empty slot, shared socket
+static unsigned int conn_rank(const struct networkfs_conn *conn) {
+  if (conn->users == 0) {
+    return conn->sock != NULL ? 0 : 1;
+  }
+  return 1 + conn->users;
+}
+
+static struct networkfs_conn *pool_try_get(struct networkfs_conn_pool *pool) {
+  struct networkfs_conn *conn = NULL;
+
+  spin_lock(&pool->lock);
+  for (size_t i = 0; i < pool->size; ++i) {
+    struct networkfs_conn *cur = &pool->conns[i];
+    if (cur->users >= pool->depth || READ_ONCE(cur->broken)) {
+      continue;
+    }
+    if (conn == NULL || conn_rank(cur) < conn_rank(conn)) {
+      conn = cur;
+    }
+  }
+  if (conn != NULL) {
+    ++conn->users;
+  }
+  spin_unlock(&pool->lock);
+
+  return conn;
+}
+
+int networkfs_conn_get(struct networkfs_conn_pool *pool,
+                       struct networkfs_conn **conn) {
+  return wait_event_interruptible(pool->wait,
+                                  (*conn = pool_try_get(pool)) != NULL);
+}
+
+void networkfs_conn_put(struct networkfs_conn_pool *pool,
+                        struct networkfs_conn *conn) {
+  spin_lock(&pool->lock);
+  bool reset = --conn->users == 0 && READ_ONCE(conn->broken);
+  spin_unlock(&pool->lock);
+
+  if (reset) {
+    // broken connections are never checked out, so the slot is ours
+    conn_close(conn);
+    spin_lock(&pool->lock);
+    WRITE_ONCE(conn->broken, false);
+    spin_unlock(&pool->lock);
+  }
+
+  wake_up(&pool->wait);
+}
+
+static void conn_break(struct networkfs_conn *conn) {
+  spin_lock(&conn->queue_lock);
+  WRITE_ONCE(conn->broken, true);
+  spin_unlock(&conn->queue_lock);
+  wake_up_all(&conn->turn);
+}
+
+// Connected stream sockets of both families are in TCP_ESTABLISHED state
+static bool conn_alive(const struct networkfs_conn *conn) {
+  const struct sock *sk = conn->sock->sk;
+  return READ_ONCE(sk->sk_state) == TCP_ESTABLISHED &&
+         (READ_ONCE(sk->sk_shutdown) & RCV_SHUTDOWN) == 0;
+}
+
+static void conn_tune(struct socket *sock,
+                      const struct networkfs_sock_opts *opts) {
+  struct sock *sk = sock->sk;
+
+  // Transport blocks in connect, send and receive, so a stalled server must
+  // not hold the caller forever
+  sk->sk_sndtimeo = opts->timeout;
+  sk->sk_rcvtimeo = opts->timeout;
+
+  // Buffers are locked like with setsockopt(), so autotuning keeps them
+  if (opts->sndbuf != 0) {
+    sock_set_sndbuf(sk, opts->sndbuf);
+  }
+  if (opts->rcvbuf != 0) {
+    sock_set_rcvbuf(sk, opts->rcvbuf);
+  }
+#ifdef CONFIG_NET_RX_BUSY_POLL
+  WRITE_ONCE(sk->sk_ll_usec, opts->busy_poll);
+#endif
+
+  if (sk->sk_family == AF_INET && opts->nodelay) {
+    // Requests are sent by a single sendmsg(), but pipelined ones must not
+    // wait for the ACK of the previous one
+    tcp_sock_set_nodelay(sk);
+  }
+}
+
+static int conn_connect(struct networkfs_conn *conn) {
+  const struct networkfs_endpoint *endpoint = &conn->pool->endpoint;
+  int family = endpoint->addr.ss_family;
+  struct socket *sock;
+  int error = sock_create_kern(&init_net, family, SOCK_STREAM,
+                               family == AF_INET ? IPPROTO_TCP : 0, &sock);
+  if (error < 0) {
+    return -ESOCKNOCREATE;
+  }
+
+  conn_tune(sock, &conn->pool->sock_opts);
+
+  error = kernel_connect(sock, (struct sockaddr *)&endpoint->addr,
+                         endpoint->addrlen, 0);
+  if (error != 0) {
+    sock_release(sock);
+    return -ESOCKNOCONNECT;
+  }
+
+  conn->sock = sock;
+  conn->eof = false;
+  conn->rbuf_start = conn->rbuf_end = 0;
+  return 0;
+}
+
+int networkfs_conn_send(struct networkfs_conn *conn,
+                        struct networkfs_conn_turn *turn, struct kvec *vec,
+                        size_t nvec, size_t length) {
+  int fresh = 0;
+  int error = 0;
+
+  turn->written = false;
+  mutex_lock(&conn->send_lock);
+
+  if (READ_ONCE(conn->broken)) {
+    error = -ESOCKNOMSGSEND;
+    goto out;
+  }
+
+  bool idle = list_empty(&conn->queue);
+  if (conn->sock != NULL && !conn_alive(conn)) {
+    if (!idle) {
+      // requests in flight are lost together with the socket
+      conn_break(conn);
+      error = -ESOCKNOMSGSEND;
+      goto out;
+    }
+    // server has closed the kept-alive session
+    conn_close(conn);
+  }
+
+  if (conn->sock == NULL) {
+    error = conn_connect(conn);
+    if (error != 0) {
+      goto out;
+    }
+    fresh = 1;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(struct msghdr));
+  error = kernel_sendmsg(conn->sock, &msg, vec, nvec, length);
+  // stream sockets report a partial send rather than the error behind it
+  turn->written = error > 0;
+  turn->idle = idle;
+  if (error != length) {
+    // a partially sent request can not be recovered
+    conn_break(conn);
+    error = -ESOCKNOMSGSEND;
+    goto out;
+  }
+  error = 0;
+
+  spin_lock(&conn->queue_lock);
+  list_add_tail(&turn->node, &conn->queue);
+  spin_unlock(&conn->queue_lock);
+
+out:
+  mutex_unlock(&conn->send_lock);
+  return error != 0 ? error : fresh;
+}
+
+// Returns 1 and claims the head turn if it is abandoned, see wait_turn
+static int conn_my_turn(struct networkfs_conn *conn,
+                        struct networkfs_conn_turn *turn) {
+  int ready = 0;
+
+  spin_lock(&conn->queue_lock);
+  struct networkfs_conn_turn *head =
+      list_first_entry(&conn->queue, struct networkfs_conn_turn, node);
+  if (READ_ONCE(conn->broken) || head == turn) {
+    ready = -1;
+  } else if (head->abandoned && !conn->draining) {
+    conn->draining = true;
+    ready = 1;
+  }
+  spin_unlock(&conn->queue_lock);
+  return ready;
+}
+
+// Leaves an abandoned turn in place of @turn, whose caller is killed
+static void conn_abandon(struct networkfs_conn *conn,
+                         struct networkfs_conn_turn *turn) {
+  struct networkfs_conn_turn *abandoned =
+      kzalloc(sizeof(struct networkfs_conn_turn), GFP_KERNEL);
+
+  spin_lock(&conn->queue_lock);
+  if (abandoned != NULL) {
+    abandoned->abandoned = true;
+    list_replace(&turn->node, &abandoned->node);
+  } else {
+    // nobody would drop the response, so the stream can not be kept
+    list_del(&turn->node);
+    WRITE_ONCE(conn->broken, true);
+  }
+  spin_unlock(&conn->queue_lock);
+  wake_up_all(&conn->turn);
+}
+
+int networkfs_conn_wait_turn(struct networkfs_conn *conn,
+                             struct networkfs_conn_turn *turn) {
+  int ready;
+  // Every response ahead is bounded by the socket timeout, but with deep
+  // pipelines they add up, so killed callers do not wait for them
+  if (wait_event_killable(conn->turn,
+                          (ready = conn_my_turn(conn, turn)) != 0) != 0) {
+    conn_abandon(conn, turn);
+    return -EINTR;
+  }
+  if (READ_ONCE(conn->broken)) {
+    if (ready == 1) {
+      networkfs_conn_finish(conn, NULL, true);
+    }
+    return -ESOCKNOMSGRECV;
+  }
+  return ready == 1 ? 1 : 0;
+}
+
+void networkfs_conn_finish(struct networkfs_conn *conn,
+                           struct networkfs_conn_turn *turn, bool error) {
+  struct networkfs_conn_turn *abandoned = NULL;
+
+  spin_lock(&conn->queue_lock);
+  if (turn == NULL) {
+    abandoned = list_first_entry(&conn->queue, struct networkfs_conn_turn,
+                                 node);
+    conn->draining = false;
+    turn = abandoned;
+  }
+  list_del(&turn->node);
+  if (error) {
+    WRITE_ONCE(conn->broken, true);
+  }
+  spin_unlock(&conn->queue_lock);
+  kfree(abandoned);
+  wake_up_all(&conn->turn);
+}
@@ -1,232 +1,720 @@
 #include "remote/http.h"
 
-#include <linux/delay.h>
-#include <linux/inet.h>
+#include <asm/byteorder.h>
+#include <linux/kernel.h>
+#include <linux/lz4.h>
+#include <linux/minmax.h>
 #include <linux/net.h>
+#include <linux/slab.h>
 #include <linux/socket.h>
 
-#include "util.h"
+#include "remote/connection.h"
+#include "remote/ops.h"
+#include "remote/urlencode.h"
+
+static const char HTTP_GET_LINE[] = "GET /networkfs/";
+static const char HTTP_POST_LINE[] = "POST /networkfs/";
+static const char HTTP_REQUEST_HEADERS[] =
+    " HTTP/1.1\r\nHost:localhost\r\n";
+static const char HTTP_BODY_HEADERS[] =
+    "Content-Type: application/octet-stream\r\nContent-Length: ";
+static const char HTTP_ACCEPT_LZ4[] = "Accept-Encoding: lz4\r\n";
+static const char HTTP_WIRE_PACKED[] = "X-Networkfs-Version: 2\r\n";
+static const char HTTP_CRLF[] = "\r\n";
+static const char HTTP_LENGTH_HEADER[] = "Content-Length";
+static const char HTTP_ENCODING_HEADER[] = "Content-Encoding";
+static const char HTTP_ENCODING_LZ4[] = "lz4";
+static const char HTTP_VERSION_HEADER[] = "X-Networkfs-Version";
+static const char HTTP_TRANSFER_HEADER[] = "Transfer-Encoding";
+static const char HTTP_TRANSFER_CHUNKED[] = "chunked";
+
+// request line, token, path, 2 pieces per argument, headers, Accept-Encoding,
+// version, body headers, Content-Length value, CRLF, empty line and payload
+#define NFS_REQUEST_MAX_VEC (3 + 2 * NFS_HTTP_MAX_ARGS + 8)
+
+#define NFS_U64_DIGITS 20
+
+// Request is sent by a single kernel_sendmsg() straight from its pieces:
+// constants, token, path, argument keys and payload are referenced as is.
+struct http_request {
+  struct kvec vec[NFS_REQUEST_MAX_VEC];
+  size_t nvec;
+  size_t size;
+  char *scratch;  // encoded argument values and Content-Length value
+};
+
+// Decimal digits of @value, without terminating zero
+static size_t format_u64(char *buffer, u64 value) {
+  char digits[NFS_U64_DIGITS];
+  size_t len = 0;
+  do {
+    digits[len++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+
+  for (size_t i = 0; i < len; ++i) {
+    buffer[i] = digits[len - 1 - i];
+  }
+  return len;
+}
 
-const char *HTTP_REQUEST_LINE = "GET /networkfs/";
-const char *HTTP_REQUEST_HEADERS =
-    " HTTP/1.1\r\nHost:localhost\r\nConnection: close\r\n\r\n";
-const char *SERVER_IP = "127.0.0.1";
-const char *HTTP_LENGTH_HEADER = "Content-Length: ";
-const u16 SERVER_PORT = 8080;
+static void request_push(struct http_request *req, const void *data,
+                         size_t len) {
+  req->vec[req->nvec].iov_base = (void *)data;
+  req->vec[req->nvec].iov_len = len;
+  ++req->nvec;
+  req->size += len;
+}
 
-static void urlnencode(char *dst, const char *src, size_t len) {
-  dst[0] = 0;
+#define request_push_const(req, str) request_push((req), (str), sizeof(str) - 1)
 
-  for (loff_t idx = 0; idx < len; ++idx) {
-    if (('0' <= src[idx] && src[idx] <= '9') ||
-        ('A' <= src[idx] && src[idx] <= 'Z') ||
-        ('a' <= src[idx] && src[idx] <= 'z')) {
-      strncat(dst, src + idx, 1);
-    } else {
-      sprintf(dst + strlen(dst), "%%%02X", (unsigned char)src[idx]);
-    }
+// callee should kfree req->scratch
+static int build_request(struct http_request *req, const char *token,
+                         const struct networkfs_http_req *call) {
+  if (call->arg_size > NFS_HTTP_MAX_ARGS) {
+    return -EINVAL;
   }
-}
 
-// callee should call free_request on received buffer
-static int fill_request(struct kvec *vec, const char *token, const char *method,
-                        size_t arg_size, va_list args) {
-  // 2048 bytes for URL and 64 bytes for anything else
-  char *request_buffer = kzalloc(2048 + 64, GFP_KERNEL);
-  if (request_buffer == 0) {
-    return -ENOMEM;
+  // Content-Length value and numbers take at most 20 digits, every byte of a
+  // string takes at most 3 bytes after encoding plus terminating zero
+  size_t scratch_size = NFS_U64_DIGITS;
+  for (size_t i = 0; i < call->arg_size; ++i) {
+    scratch_size += call->args[i].kind == NFS_ARG_STR
+                        ? 3 * call->args[i].len + 1
+                        : NFS_U64_DIGITS;
   }
 
-  strcpy(request_buffer, HTTP_REQUEST_LINE);
-  strcat(request_buffer, token);
-  strcat(request_buffer, "/fs/");
-  strcat(request_buffer, method);
+  req->scratch = kmalloc(scratch_size, GFP_KERNEL);
+  if (req->scratch == NULL) {
+    return -ENOMEM;
+  }
+  char *scratch = req->scratch;
+  req->nvec = 0;
+  req->size = 0;
+
+  if (call->body != NULL) {
+    request_push_const(req, HTTP_POST_LINE);
+  } else {
+    request_push_const(req, HTTP_GET_LINE);
+  }
+  request_push(req, token, strlen(token));
+  request_push(req, call->op->path, call->op->path_len);
+
+  for (size_t i = 0; i < call->arg_size; ++i) {
+    const struct networkfs_http_arg *arg = &call->args[i];
+
+    request_push(req, arg->key, arg->key_len);
+    size_t len = arg->kind == NFS_ARG_STR
+                     ? networkfs_urlencode(scratch, arg->value, arg->len)
+                     : format_u64(scratch, arg->number);
+    request_push(req, scratch, len);
+    scratch += len;
+  }
 
-  for (int i = 0; i < arg_size; i++) {
-    strcat(request_buffer, i == 0 ? "?" : "&");
-    strcat(request_buffer, va_arg(args, char *));
-    strcat(request_buffer, "=");
+  request_push_const(req, HTTP_REQUEST_HEADERS);
+  if (call->compress && call->consume == NULL) {
+    // a block is decoded only as a whole, it can not be streamed
+    request_push_const(req, HTTP_ACCEPT_LZ4);
+  }
+  if (call->version == NFS_WIRE_PACKED) {
+    request_push_const(req, HTTP_WIRE_PACKED);
+  }
+  if (call->body != NULL) {
+    request_push_const(req, HTTP_BODY_HEADERS);
+    request_push(req, scratch, format_u64(scratch, call->body_size));
+    request_push_const(req, HTTP_CRLF);
+  }
+  request_push_const(req, HTTP_CRLF);
+  if (call->body != NULL && call->body_size != 0) {
+    request_push(req, call->body, call->body_size);
+  }
 
-    const char *raw_value = va_arg(args, const char *);
-    size_t value_len = va_arg(args, size_t);
+  return 0;
+}
 
-    urlnencode(request_buffer + strlen(request_buffer), raw_value, value_len);
+static int conn_recv(struct networkfs_conn *conn, void *buffer, size_t size) {
+  struct msghdr hdr;
+  struct kvec vec = {.iov_base = buffer, .iov_len = size};
+  memset(&hdr, 0, sizeof(struct msghdr));
+
+  int ret = kernel_recvmsg(conn->sock, &hdr, &vec, 1, size, 0);
+  if (ret == -EAGAIN) {
+    // SO_RCVTIMEO expired
+    return -ESOCKTIMEOUT;
+  } else if (ret == -ERESTARTSYS || ret == -EINTR) {
+    return -EINTR;
+  } else if (ret <= 0) {
+    // error, or peer closed the connection in the middle of response
+    conn->eof = ret == 0;
+    return -ESOCKNOMSGRECV;
   }
+  return ret;
+}
 
-  strcat(request_buffer, HTTP_REQUEST_HEADERS);
+// Returns the next header line without CRLF. The line points into the
+// connection receive buffer and is valid until the next read. Data following
+// the headers stays buffered, it belongs to the body or to the next response.
+static int read_line(struct networkfs_conn *conn, const char **line,
+                     size_t *len) {
+  size_t scanned = conn->rbuf_start;
 
-  memset(vec, 0, sizeof(struct kvec));
-  vec->iov_base = request_buffer;
-  vec->iov_len = strlen(request_buffer);
+  while (true) {
+    char *begin = conn->rbuf + conn->rbuf_start;
+    char *lf = memchr(conn->rbuf + scanned, '\n', conn->rbuf_end - scanned);
+    if (lf != NULL) {
+      *line = begin;
+      *len = lf - begin;
+      if (*len > 0 && lf[-1] == '\r') {
+        --*len;
+      }
+      conn->rbuf_start = lf + 1 - conn->rbuf;
+      return 0;
+    }
+    scanned = conn->rbuf_end;
 
-  return 0;
+    if (conn->rbuf_end == NFS_RBUF_SIZE) {
+      if (conn->rbuf_start == 0) {
+        // a single header line does not fit into the buffer
+        return -EHTTPMALFORMED;
+      }
+      memmove(conn->rbuf, begin, conn->rbuf_end - conn->rbuf_start);
+      conn->rbuf_end -= conn->rbuf_start;
+      scanned -= conn->rbuf_start;
+      conn->rbuf_start = 0;
+    }
+
+    int ret = conn_recv(conn, conn->rbuf + conn->rbuf_end,
+                        NFS_RBUF_SIZE - conn->rbuf_end);
+    if (ret < 0) {
+      return ret;
+    }
+    conn->rbuf_end += ret;
+  }
 }
 
-static int receive_all(struct socket *sock, char *buffer, size_t buffer_size) {
-  struct msghdr hdr;
-  struct kvec vec;
-
-  int read = 0;
-  int tried = -1;
-
-  while (read < buffer_size) {
-    memset(&hdr, 0, sizeof(struct msghdr));
-    memset(&vec, 0, sizeof(struct kvec));
-    vec.iov_base = buffer + read;
-    vec.iov_len = buffer_size - read;
-    int ret = kernel_recvmsg(sock, &hdr, &vec, 1, vec.iov_len, MSG_DONTWAIT);
-    if (ret == -EAGAIN) {
-      if (tried != -1) ++tried;
-      if (tried == 3) {
-        break;
-      }
-      msleep_interruptible(25);
-      continue;
-    } else if (ret == 0) {
-      break;
-    } else if (ret < 0) {
-      return -ESOCKNOMSGRECV;
+// Reads exactly @size bytes of the body. Buffered bytes are taken first, the
+// rest is received straight into @buffer. If @buffer is NULL, data is dropped.
+static int read_exact(struct networkfs_conn *conn, void *buffer, size_t size) {
+  size_t buffered = min(size, conn->rbuf_end - conn->rbuf_start);
+  if (buffer != NULL) {
+    memcpy(buffer, conn->rbuf + conn->rbuf_start, buffered);
+  }
+  conn->rbuf_start += buffered;
+  if (conn->rbuf_start == conn->rbuf_end) {
+    conn->rbuf_start = conn->rbuf_end = 0;
+  }
+
+  for (size_t done = buffered; done < size;) {
+    int ret = buffer != NULL
+                  ? conn_recv(conn, (char *)buffer + done, size - done)
+                  : conn_recv(conn, conn->rbuf,
+                              min_t(size_t, size - done, NFS_RBUF_SIZE));
+    if (ret < 0) {
+      return ret;
     }
-    tried = 0;
-    read += ret;
+    done += ret;
   }
 
-  return read;
+  return 0;
+}
+
+static bool header_is(const char *line, size_t len, const char *name) {
+  size_t name_len = strlen(name);
+  return len > name_len && line[name_len] == ':' &&
+         strncasecmp(line, name, name_len) == 0;
+}
+
+// Value of a header line without surrounding spaces
+static const char *header_value(const char *line, size_t len,
+                                const char *name, size_t *value_len) {
+  const char *value = line + strlen(name) + 1;
+  len -= strlen(name) + 1;
+  while (len > 0 && *value == ' ') {
+    ++value;
+    --len;
+  }
+  while (len > 0 && value[len - 1] == ' ') {
+    --len;
+  }
+  *value_len = len;
+  return value;
 }
 
-static int64_t parse_http_response(char *raw_response, size_t raw_response_size,
-                                   char *response, size_t response_size) {
-  char *buffer = raw_response;
+static ssize_t parse_length(const char *value, size_t len) {
+  if (len == 0) {
+    return -EHTTPMALFORMED;
+  }
 
-  // Read Response Line
-  {
-    char *status_line = strsep(&buffer, "\r");
-    strsep(&status_line, " ");
-    if (status_line == 0) {
+  ssize_t length = 0;
+  for (; len > 0; ++value, --len) {
+    if (*value < '0' || *value > '9' || length > SSIZE_MAX / 10) {
       return -EHTTPMALFORMED;
     }
-    char *status_code = strsep(&status_line, " ");
-    if (strcmp(status_code, "200") != 0) {
-      return -EHTTPBADCODE;
+    length = length * 10 + (*value - '0');
+  }
+  return length;
+}
+
+// Body of a response, delimited either by Content-Length or by chunks
+struct http_body {
+  struct networkfs_conn *conn;
+  bool last;    // nothing follows the current chunk
+  bool crlf;    // data of the current chunk is not yet followed by CRLF
+  size_t left;  // bytes left in the body or in the current chunk
+  size_t read;  // bytes of the body read so far
+};
+
+static void body_init(struct http_body *body, struct networkfs_conn *conn,
+                      ssize_t length) {
+  // a chunked body starts as a finished empty chunk
+  *body = (struct http_body){.conn = conn,
+                             .last = length >= 0,
+                             .left = length >= 0 ? length : 0};
+}
+
+// "1f4;extension"
+static int parse_chunk_size(const char *line, size_t len, size_t *size) {
+  size_t digits = 0;
+  *size = 0;
+  for (; digits < len && line[digits] != ';' && line[digits] != ' ';
+       ++digits) {
+    int digit = hex_to_bin(line[digits]);
+    if (digit < 0 || *size > (SIZE_MAX >> 4)) {
+      return -EHTTPMALFORMED;
     }
+    *size = (*size << 4) | digit;
   }
+  return digits > 0 ? 0 : -EHTTPMALFORMED;
+}
 
-  int length = -1;
+// Starts the next chunk once the current one is read. Trailers after the last
+// chunk are skipped, so the body is consumed completely.
+static int body_advance(struct http_body *body) {
+  const char *line;
+  size_t len;
+  int error;
 
-  while (true) {
-    if (buffer == 0) {
+  if (body->left != 0 || body->last) {
+    return 0;
+  }
+  if (body->crlf) {
+    error = read_line(body->conn, &line, &len);
+    if (error != 0) {
+      return error;
+    }
+    if (len != 0) {
       return -EHTTPMALFORMED;
     }
-    char *header = strsep(&buffer, "\r");
-    ++header;  // skip \n
-    if (strcmp(header, "") == 0) {
-      // end of headers
-      break;
+    body->crlf = false;
+  }
+
+  error = read_line(body->conn, &line, &len);
+  if (error != 0) {
+    return error;
+  }
+  error = parse_chunk_size(line, len, &body->left);
+  if (error != 0) {
+    return error;
+  }
+  if (body->left != 0) {
+    body->crlf = true;
+    return 0;
+  }
+
+  body->last = true;
+  do {
+    error = read_line(body->conn, &line, &len);
+  } while (error == 0 && len != 0);
+  return error;
+}
+
+// Reads exactly @size bytes of the body, see read_exact()
+static int body_read(struct http_body *body, void *buffer, size_t size) {
+  while (size > 0) {
+    int error = body_advance(body);
+    if (error != 0) {
+      return error;
+    }
+    if (body->left == 0) {
+      return -EPROTMALFORMED;
     }
 
-    if (strncmp(header, HTTP_LENGTH_HEADER, strlen(HTTP_LENGTH_HEADER)) == 0) {
-      int error = kstrtoint(header + strlen(HTTP_LENGTH_HEADER), 0, &length);
-      if (error != 0) {
-        return -EHTTPMALFORMED;
-      }
+    size_t len = min(size, body->left);
+    error = read_exact(body->conn, buffer, len);
+    if (error != 0) {
+      return error;
+    }
+    body->left -= len;
+    body->read += len;
+    size -= len;
+    if (buffer != NULL) {
+      buffer = (char *)buffer + len;
     }
   }
-  ++buffer;  // skip last '\n'
+  return 0;
+}
 
-  if (length == -1) {
-    return -EHTTPMALFORMED;
+// Next piece of the body, taken right from the connection buffer and valid
+// until the next read. @len is 0 at the end of the body.
+static int body_piece(struct http_body *body, const char **data,
+                      size_t *len) {
+  struct networkfs_conn *conn = body->conn;
+  *len = 0;
+
+  int error = body_advance(body);
+  if (error != 0 || body->left == 0) {
+    return error;
+  }
+  if (conn->rbuf_start == conn->rbuf_end) {
+    int ret = conn_recv(conn, conn->rbuf, NFS_RBUF_SIZE);
+    if (ret < 0) {
+      return ret;
+    }
+    conn->rbuf_start = 0;
+    conn->rbuf_end = ret;
   }
 
-  if (buffer + length > raw_response + raw_response_size) {
-    return -EHTTPMALFORMED;
+  *data = conn->rbuf + conn->rbuf_start;
+  *len = min(body->left, conn->rbuf_end - conn->rbuf_start);
+  conn->rbuf_start += *len;
+  body->left -= *len;
+  body->read += *len;
+  return 0;
+}
+
+static int body_drain(struct http_body *body) {
+  const char *data;
+  size_t len;
+  int error;
+  do {
+    error = body_piece(body, &data, &len);
+  } while (error == 0 && len != 0);
+  return error;
+}
+
+// Status from the leading bytes of a body, followed by @payload bytes
+static int64_t parse_status(const void *prefix, unsigned int version,
+                            size_t payload) {
+  if (version != NFS_WIRE_PACKED) {
+    int64_t status;
+    memcpy(&status, prefix, sizeof(int64_t));
+    return status;
   }
 
-  if (length < sizeof(int64_t)) {
+  const struct networkfs_wire_header *header = prefix;
+  if (header->version != NFS_WIRE_PACKED ||
+      le32_to_cpu(header->length) != payload) {
     return -EPROTMALFORMED;
   }
+  return le16_to_cpu(header->status);
+}
 
-  length -= sizeof(int64_t);
+/*
+ * Compressed body can not be received in place: the block is received to a
+ * temporary buffer and decompressed into a second one, since the status at
+ * its start is returned separately. The second one has a spare byte, which
+ * tells a body too large for the response buffer from a corrupted block.
+ */
+static int64_t receive_lz4(struct networkfs_conn *conn, size_t length,
+                           struct networkfs_http_req *call, bool *in_sync) {
+  size_t decoded_size = sizeof(int64_t) + call->response_size;
+  char *buffer = kmalloc(length + decoded_size + 1, GFP_KERNEL);
+  if (buffer == NULL) {
+    // drop the body to keep the connection usable
+    *in_sync = read_exact(conn, NULL, length) == 0;
+    return -ENOMEM;
+  }
+  char *decoded = buffer + length;
 
-  if (length > response_size) {
-    return -ENOSPC;
+  int64_t result = read_exact(conn, buffer, length);
+  if (result != 0) {
+    goto out;
+  }
+  *in_sync = true;
+
+  int size = LZ4_decompress_safe(buffer, decoded, length, decoded_size);
+  if (size < 0) {
+    // a block decoding past the buffer is a body that does not fit, as with
+    // uncompressed ones, anything else is corrupted
+    int spare = decoded_size + 1;
+    bool large = LZ4_decompress_safe_partial(buffer, decoded, length, spare,
+                                             spare) == spare;
+    result = large ? -ENOSPC : -EPROTMALFORMED;
+    goto out;
   }
+  if (size < (int)sizeof(int64_t)) {
+    result = -EPROTMALFORMED;
+    goto out;
+  }
+  memcpy(call->response, decoded + sizeof(int64_t), size - sizeof(int64_t));
+  call->received = size - sizeof(int64_t);
+  result = parse_status(decoded, call->version, size - sizeof(int64_t));
 
-  int64_t return_value;
-  memcpy(&return_value, buffer, sizeof(int64_t));
+out:
+  kfree(buffer);
+  return result;
+}
 
-  buffer += sizeof(int64_t);
-  memcpy(response, buffer, length);
+/*
+ * Payload of unknown length, or one that goes to the consumer of @call, is
+ * taken piece by piece. Once the consumer fails or the response buffer is
+ * exceeded, the rest is dropped and the error is stored to @result.
+ */
+static int receive_pieces(struct http_body *body,
+                          struct networkfs_http_req *call, int64_t *result) {
+  size_t received = 0;
 
-  return return_value;
+  while (true) {
+    const char *data;
+    size_t len;
+    int error = body_piece(body, &data, &len);
+    if (error != 0 || len == 0) {
+      return error;
+    }
+    if (*result != 0) {
+      continue;
+    }
+
+    if (call->consume != NULL) {
+      *result = call->consume(call, data, len);
+      call->consumed += len;
+    } else if (len > call->response_size - received) {
+      *result = -ENOSPC;
+    } else {
+      memcpy(call->response + received, data, len);
+      received += len;
+    }
+  }
 }
 
-int64_t networkfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...) {
-  struct socket *sock;
-  int64_t error;
+/*
+ * Receives the response of the caller at the head of the connection queue.
+ * Status line and headers are parsed line by line from the connection buffer,
+ * the leading status of the body goes to the result. The rest of the body is
+ * received right into the response buffer of @call, or passed to its consumer
+ * as it arrives. @in_sync is set if the response has been consumed
+ * completely, so the connection can carry the next one.
+ */
+// Reads the next response into @call, or drops it if @call is NULL
+static int64_t receive_response(struct networkfs_conn *conn,
+                                struct networkfs_http_req *call,
+                                bool *in_sync, bool *unanswered) {
+  size_t response_size = call != NULL ? call->response_size : 0;
+  const char *line;
+  size_t len;
+  *in_sync = false;
+  *unanswered = false;
+  if (call != NULL) {
+    call->received = 0;
+  }
 
-  error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
-  if (error < 0) {
-    return -ESOCKNOCREATE;
+  int error = read_line(conn, &line, &len);
+  if (error != 0) {
+    // closed cleanly before a byte of the response arrived
+    *unanswered = conn->eof && conn->rbuf_start == conn->rbuf_end;
+    return error;
   }
+  // "HTTP/1.1 200 OK"
+  const char *code = memchr(line, ' ', len);
+  if (code == NULL || line + len - code < 4) {
+    return -EHTTPMALFORMED;
+  }
+  bool success = strncmp(code + 1, "200", 3) == 0;
 
-  struct sockaddr_in s_addr = {.sin_family = AF_INET,
-                               .sin_addr = {.s_addr = in_aton(SERVER_IP)},
-                               .sin_port = htons(SERVER_PORT)};
+  ssize_t length = -1;
+  bool chunked = false;
+  bool compressed = false;
+  ssize_t version = NFS_WIRE_LEGACY;
+  while (true) {
+    error = read_line(conn, &line, &len);
+    if (error != 0) {
+      return error;
+    }
+    if (len == 0) {
+      // end of headers
+      break;
+    }
+    if (header_is(line, len, HTTP_LENGTH_HEADER)) {
+      size_t value_len;
+      const char *value =
+          header_value(line, len, HTTP_LENGTH_HEADER, &value_len);
+      length = parse_length(value, value_len);
+      if (length < 0) {
+        return length;
+      }
+    } else if (header_is(line, len, HTTP_TRANSFER_HEADER)) {
+      size_t value_len;
+      const char *value =
+          header_value(line, len, HTTP_TRANSFER_HEADER, &value_len);
+      if (value_len != strlen(HTTP_TRANSFER_CHUNKED) ||
+          strncasecmp(value, HTTP_TRANSFER_CHUNKED, value_len) != 0) {
+        return -EHTTPMALFORMED;
+      }
+      chunked = true;
+    } else if (header_is(line, len, HTTP_ENCODING_HEADER)) {
+      size_t value_len;
+      const char *value =
+          header_value(line, len, HTTP_ENCODING_HEADER, &value_len);
+      if (value_len != strlen(HTTP_ENCODING_LZ4) ||
+          strncasecmp(value, HTTP_ENCODING_LZ4, value_len) != 0) {
+        // the only encoding ever accepted
+        return -EHTTPMALFORMED;
+      }
+      compressed = true;
+    } else if (header_is(line, len, HTTP_VERSION_HEADER)) {
+      size_t value_len;
+      const char *value =
+          header_value(line, len, HTTP_VERSION_HEADER, &value_len);
+      version = parse_length(value, value_len);
+      if (version < 0) {
+        return version;
+      }
+    }
+  }
 
-  error = kernel_connect(sock, (struct sockaddr *)&s_addr,
-                         sizeof(struct sockaddr_in), 0);
-  if (error != 0) {
-    sock_release(sock);
-    return -ESOCKNOCONNECT;
+  if (chunked) {
+    // chunks take precedence over Content-Length
+    length = -1;
+  } else if (length == -1) {
+    return -EHTTPMALFORMED;
+  }
+  struct http_body body;
+  body_init(&body, conn, length);
+
+  int64_t result = 0;
+  if (call == NULL) {
+    // the caller was killed
+    result = -ECANCELED;
+  } else if (!success) {
+    result = -EHTTPBADCODE;
+  } else if (version != call->version) {
+    // server does not speak the format requested at mount time
+    result = -EPROTVERSION;
+  } else if (compressed) {
+    if (chunked || call->consume != NULL) {
+      // blocks are neither sent in chunks nor requested for streaming
+      result = -EHTTPMALFORMED;
+    } else if ((size_t)length >
+               LZ4_COMPRESSBOUND(sizeof(int64_t) + response_size)) {
+      // a valid block never exceeds the bound of the largest expected body
+      result = -ENOSPC;
+    }
+  } else if (!chunked && (size_t)length < sizeof(int64_t)) {
+    result = -EPROTMALFORMED;
+  } else if (!chunked && call->consume == NULL &&
+             (size_t)length - sizeof(int64_t) > response_size) {
+    // chunks are checked against the buffer as they arrive
+    result = -ENOSPC;
+  }
+  if (result != 0) {
+    // drop the body to keep the connection usable
+    error = body_drain(&body);
+    *in_sync = error == 0;
+    return result;
   }
 
-  struct kvec kvec;
-  va_list args;
-  va_start(args, arg_size);
-  error = fill_request(&kvec, token, method, arg_size, args);
-  va_end(args);
+  if (compressed) {
+    return receive_lz4(conn, length, call, in_sync);
+  }
 
+  char prefix[sizeof(int64_t)];
+  error = body_read(&body, prefix, sizeof(int64_t));
+  if (error == 0) {
+    error = chunked || call->consume != NULL
+                ? receive_pieces(&body, call, &result)
+                : body_read(&body, call->response,
+                            length - sizeof(int64_t));
+  }
   if (error != 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
     return error;
   }
 
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(struct msghdr));
+  *in_sync = true;
+  if (result != 0) {
+    return result;
+  }
+  call->received = body.read - sizeof(int64_t);
+  return parse_status(prefix, call->version, body.read - sizeof(int64_t));
+}
 
-  error = kernel_sendmsg(sock, &msg, &kvec, 1, kvec.iov_len);
-  kfree(kvec.iov_base);
+// Sends the request and receives the response over a checked out connection.
+// Returns the status from the response body or negated errno. @unsent is set
+// if the failed request can not have been executed by the server: it never
+// reached the socket, or the server closed a socket that was idle when the
+// request went over it before answering.
+static int64_t exchange(struct networkfs_conn *conn,
+                        struct http_request *request,
+                        struct networkfs_http_req *call, bool *unsent) {
+  struct networkfs_conn_turn turn;
+  *unsent = false;
+
+  if (call->may_send != NULL && !call->may_send(call)) {
+    return -ECANCELED;
+  }
 
+  int error = networkfs_conn_send(conn, &turn, request->vec, request->nvec,
+                                  request->size);
   if (error < 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ESOCKNOMSGSEND;
+    // connect failures are retried by remote/rpc.c
+    *unsent = error == -ESOCKNOMSGSEND && !turn.written;
+    return error;
   }
-
-  size_t raw_buffer_size = buffer_size + 1024;  // add 1KB for HTTP headers
-  char *raw_response_buffer = kmalloc(raw_buffer_size, GFP_KERNEL);
-  if (raw_response_buffer == 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ENOMEM;
+  bool fresh = error == 1;
+
+  bool in_sync = false;
+  bool unanswered = false;
+  int64_t result;
+  while ((result = networkfs_conn_wait_turn(conn, &turn)) == 1) {
+    // the response of a killed caller comes first
+    receive_response(conn, NULL, &in_sync, &unanswered);
+    networkfs_conn_finish(conn, NULL, !in_sync);
+  }
+  if (result == -EINTR) {
+    // the turn is left to be drained by the callers behind it
+    return result;
   }
-  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size);
+  in_sync = false;
+  unanswered = false;
+  if (result == 0) {
+    result = receive_response(conn, call, &in_sync, &unanswered);
+  }
+  // a new socket closed at once would be closed again
+  *unsent = !fresh && turn.idle && unanswered;
 
-  kernel_sock_shutdown(sock, SHUT_RDWR);
-  sock_release(sock);
+  networkfs_conn_finish(conn, &turn, !in_sync);
+  return result;
+}
 
-  if (read_bytes < 0) {
-    kfree(raw_response_buffer);
-    return -ESOCKNOMSGRECV;
+int64_t networkfs_http_exec(struct networkfs_conn_pool *pool,
+                            const char *token,
+                            struct networkfs_http_req *req) {
+  struct http_request request;
+  int64_t result = build_request(&request, token, req);
+  if (result != 0) {
+    return result;
   }
 
-  error = 0;
-  error = parse_http_response(raw_response_buffer, read_bytes, response_buffer,
-                              buffer_size);
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    struct networkfs_conn *conn;
+    result = networkfs_conn_get(pool, &conn);
+    if (result != 0) {
+      break;
+    }
 
-  kfree(raw_response_buffer);
-  return error;
+    // kernel_sendmsg() advances the iterator, not kvec itself, so the same
+    // vector can be resent
+    bool unsent = false;
+    result = exchange(conn, &request, req, &unsent);
+    networkfs_conn_put(pool, conn);
+
+    // Resend once over a new socket only if the server can not have executed
+    // the request, whatever the call. Transport failures after that are left
+    // to the retries of idempotent calls in remote/rpc.c.
+    if (!unsent) {
+      break;
+    }
+  }
+
+  kfree(request.scratch);
+  return result;
 }
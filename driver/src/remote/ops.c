@@ -0,0 +1,61 @@
+#include "remote/ops.h"
+
+#include <linux/build_bug.h>
+
+#define NFS_OP_PATH(call) "/fs/" #call "?"
+
+#define NFS_OP_DESC(call, call_flags, call_args)                \
+  [NFS_OP_##call] = {.name = #call,                             \
+                     .path = NFS_OP_PATH(call),                 \
+                     .path_len = sizeof(NFS_OP_PATH(call)) - 1, \
+                     .flags = (call_flags)},
+
+const struct networkfs_op networkfs_ops[NFS_OP_COUNT] = {NFS_OPS(NFS_OP_DESC)};
+
+// Keys are stored as "&key=". The path already ends with '?', so the first
+// argument goes without the separator.
+static struct networkfs_http_arg *push_arg(struct networkfs_http_req *req,
+                                           const char *key, size_t key_len) {
+  struct networkfs_http_arg *arg = &req->args[req->arg_size];
+  size_t skip = req->arg_size == 0 ? 1 : 0;
+  arg->key = key + skip;
+  arg->key_len = key_len - skip;
+  ++req->arg_size;
+  return arg;
+}
+
+static void encode_ino(struct networkfs_http_req *req, const char *key,
+                       size_t key_len, u64 ino) {
+  struct networkfs_http_arg *arg = push_arg(req, key, key_len);
+  arg->kind = NFS_ARG_NUM;
+  arg->number = ino;
+}
+
+static void encode_num(struct networkfs_http_req *req, const char *key,
+                       size_t key_len, u64 num) {
+  encode_ino(req, key, key_len, num);
+}
+
+static void encode_str(struct networkfs_http_req *req, const char *key,
+                       size_t key_len, struct qstr str) {
+  struct networkfs_http_arg *arg = push_arg(req, key, key_len);
+  arg->kind = NFS_ARG_STR;
+  arg->value = (const char *)str.name;
+  arg->len = str.len;
+}
+
+#define NFS_OP_ARG_KEY(field) "&" #field "="
+#define NFS_OP_ARG_COUNT(type, field) +1
+#define NFS_OP_ARG_ENCODE(type, field)      \
+  encode_##type(req, NFS_OP_ARG_KEY(field), \
+                sizeof(NFS_OP_ARG_KEY(field)) - 1, args->field);
+
+#define NFS_OP_ENCODER(call, call_flags, call_args)                            \
+  static_assert(0 call_args(NFS_OP_ARG_COUNT) <= NFS_HTTP_MAX_ARGS);           \
+  void networkfs_##call##_encode(struct networkfs_http_req *req,               \
+                                 const struct networkfs_##call##_args *args) { \
+    *req = (struct networkfs_http_req){.op = &networkfs_ops[NFS_OP_##call]};   \
+    call_args(NFS_OP_ARG_ENCODE)                                               \
+  }
+
+NFS_OPS(NFS_OP_ENCODER)
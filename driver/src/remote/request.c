@@ -1,6 +1,12 @@
 #include "remote/request.h"
 
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#include "networkfs.h"
 #include "remote/http.h"
+#include "remote/ops.h"
+#include "remote/rpc.h"
 #include "util.h"
 
 static int64_t handle_error(int64_t error_code) {
@@ -14,15 +20,188 @@ static int64_t handle_error(int64_t error_code) {
   return error_code;  // it is an error from errno-base or response status
 }
 
+/*
+ * Packed wire format (vers=2), encoded by server/run_server. Integers are
+ * unsigned LEB128 varints, names are prefixed with their length:
+ *
+ *   lookup:   u8 type, varint ino
+ *   list:     varint count, then count times u8 type, varint ino,
+ *             varint cookie, varint name length, name, then u8 eof
+ *   create:   varint ino
+ *   read:     varint size, content
+ *   getattr:  u8 type, varint ino, varint size, varint nlink,
+ *             varint mtime, varint ctime (nanoseconds)
+ *   listplus: as list, with the rest of getattr after the ino of every entry
+ *   lookup_path: varint count, then count times lookup
+ *   compound: varint count of the calls executed, then count times varint
+ *             status, varint payload length, payload of the call
+ *
+ * Payloads are decoded into the same structures as the legacy format, except
+ * for list and listplus, which are decoded entry by entry as they arrive.
+ *
+ * The body of a compound request holds its calls one after another, each as
+ * varint op length, op, varint argument count, then count times varint key
+ * length, key, u8 kind and the value (COMPOUND_ARG_*):
+ *   number: varint;
+ *   string: varint length, string;
+ *   result: varint index of an earlier call, the ino it returned is used;
+ * then varint body length, body.
+ */
+
+#define NFS_WIRE_VARINT_MAX 10
+#define NFS_WIRE_ENTRY_INFO_MAX (1 + NFS_WIRE_VARINT_MAX)
+#define NFS_WIRE_ATTR_MAX (1 + 5 * NFS_WIRE_VARINT_MAX)
+#define NFS_WIRE_PATH_INFO_MAX \
+  (NFS_WIRE_VARINT_MAX + NFS_LOOKUP_PATH_MAX * NFS_WIRE_ENTRY_INFO_MAX)
+#define NFS_WIRE_DIR_ENTRY_MAX (1 + 7 * NFS_WIRE_VARINT_MAX + NFS_NAME_MAX)
+
+struct wire_cursor {
+  const u8 *pos;
+  const u8 *end;
+};
+
+static bool wire_u8(struct wire_cursor *cursor, u8 *value) {
+  if (cursor->pos == cursor->end) {
+    return false;
+  }
+  *value = *cursor->pos++;
+  return true;
+}
+
+static bool wire_varint(struct wire_cursor *cursor, u64 *value) {
+  *value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    u8 byte;
+    if (!wire_u8(cursor, &byte)) {
+      return false;
+    }
+    *value |= (u64)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static const u8 *wire_bytes(struct wire_cursor *cursor, size_t len) {
+  if ((size_t)(cursor->end - cursor->pos) < len) {
+    return NULL;
+  }
+  const u8 *bytes = cursor->pos;
+  cursor->pos += len;
+  return bytes;
+}
+
+static int64_t wire_malformed(const char *method) {
+  printk(KERN_ERR "networkfs: %s: malformed response payload\n", method);
+  return -EIO;
+}
+
+static int64_t decode_entry_info(const u8 *wire, size_t size,
+                                 struct networkfs_entry_info *result) {
+  struct wire_cursor cursor = {wire, wire + size};
+  u64 ino;
+  if (!wire_u8(&cursor, &result->entry_type) || !wire_varint(&cursor, &ino)) {
+    return wire_malformed("request_lookup");
+  }
+  result->ino = ino;
+  return 0;
+}
+
+// Type and ino, followed by the rest of the attributes if @full is set
+static bool wire_attr(struct wire_cursor *cursor, struct networkfs_attr *attr,
+                      bool full) {
+  u64 ino, mtime = 0, ctime = 0;
+  *attr = (struct networkfs_attr){};
+  if (!wire_u8(cursor, &attr->entry_type) || !wire_varint(cursor, &ino)) {
+    return false;
+  }
+  if (full && (!wire_varint(cursor, &attr->size) ||
+               !wire_varint(cursor, &attr->nlink) ||
+               !wire_varint(cursor, &mtime) || !wire_varint(cursor, &ctime))) {
+    return false;
+  }
+  attr->ino = ino;
+  attr->mtime = mtime;
+  attr->ctime = ctime;
+  return true;
+}
+
+static int64_t decode_path_info(const u8 *wire, size_t size,
+                                struct networkfs_path_info *result) {
+  struct wire_cursor cursor = {wire, wire + size};
+  u64 count;
+  if (!wire_varint(&cursor, &count) || count > NFS_LOOKUP_PATH_MAX) {
+    return wire_malformed("request_lookup_path");
+  }
+  for (size_t i = 0; i < count; ++i) {
+    struct networkfs_entry_info *entry = &result->entries[i];
+    u64 ino;
+    if (!wire_u8(&cursor, &entry->entry_type) || !wire_varint(&cursor, &ino)) {
+      return wire_malformed("request_lookup_path");
+    }
+    entry->ino = ino;
+  }
+  result->count = count;
+  return 0;
+}
+
+static int64_t decode_attr(const u8 *wire, size_t size,
+                           struct networkfs_attr *result) {
+  struct wire_cursor cursor = {wire, wire + size};
+  if (!wire_attr(&cursor, result, true)) {
+    return wire_malformed("request_getattr");
+  }
+  return 0;
+}
+
+static int64_t decode_ino(const u8 *wire, size_t size, ino_t *result) {
+  struct wire_cursor cursor = {wire, wire + size};
+  u64 ino;
+  if (!wire_varint(&cursor, &ino)) {
+    return wire_malformed("request_create_generic");
+  }
+  *result = ino;
+  return 0;
+}
+
+// Content of a payload of @size bytes is moved in place behind a native u64
+// size, as in the legacy format
+static int64_t decode_content(void *buffer, size_t buffer_size, size_t size) {
+  struct wire_cursor cursor = {buffer, buffer + size};
+  u64 content_size;
+  const u8 *content;
+  if (!wire_varint(&cursor, &content_size) ||
+      content_size > buffer_size - sizeof(u64) ||
+      (content = wire_bytes(&cursor, content_size)) == NULL) {
+    return wire_malformed("request_read");
+  }
+  memmove(buffer + sizeof(u64), content, content_size);
+  *(u64 *)buffer = content_size;
+  return 0;
+}
+
+// Payloads in the legacy format are native structures, fixed in size
+static int64_t check_legacy(const struct networkfs_http_req *req, size_t size,
+                            const char *method) {
+  return req->received < size ? wire_malformed(method) : 0;
+}
+
 int64_t networkfs_request_lookup(const struct inode *parent,
                                  const struct dentry *child,
                                  struct networkfs_entry_info *result) {
-  const char *token = parent->i_sb->s_fs_info;
+  struct networkfs_sb_info *sbi = NFS_SB(parent->i_sb);
   const char *name = child->d_name.name;
-  ino_to_string(parent_ino_str, parent->i_ino);
-  int64_t http_status = networkfs_http_call(
-      token, "lookup", (char *)result, sizeof(struct networkfs_entry_info), 2,
-      "parent", parent_ino_str, strlen(parent_ino_str), "name", wstr(name));
+  bool packed = sbi->vers == NFS_WIRE_PACKED;
+  u8 wire[NFS_WIRE_ENTRY_INFO_MAX];
+  const struct networkfs_lookup_args args = {.parent = parent->i_ino,
+                                             .name = child->d_name};
+  struct networkfs_http_req req;
+  networkfs_lookup_encode(&req, &args);
+  req.response = packed ? (char *)wire : (char *)result;
+  req.response_size =
+      packed ? sizeof(wire) : sizeof(struct networkfs_entry_info);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -57,19 +236,152 @@ int64_t networkfs_request_lookup(const struct inode *parent,
     return -EIO;
   }
 
+  return packed ? decode_entry_info(wire, req.received, result)
+                : check_legacy(&req, sizeof(*result), "request_lookup");
+}
+
+int64_t networkfs_request_lookup_path(const struct inode *parent,
+                                      struct qstr path,
+                                      struct networkfs_path_info *result) {
+  struct networkfs_sb_info *sbi = NFS_SB(parent->i_sb);
+  bool packed = sbi->vers == NFS_WIRE_PACKED;
+  u8 wire[NFS_WIRE_PATH_INFO_MAX];
+  const struct networkfs_lookup_path_args args = {.parent = parent->i_ino,
+                                                  .path = path};
+  struct networkfs_http_req req;
+  networkfs_lookup_path_encode(&req, &args);
+  req.response = packed ? (char *)wire : (char *)result;
+  req.response_size =
+      packed ? sizeof(wire) : sizeof(struct networkfs_path_info);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
+
+  if ((http_status = handle_error(http_status)) < 0) {
+    return http_status;
+  }
+
+  if (http_status == 1) {
+    printk(KERN_ERR
+           "networkfs: request_lookup_path: parent inode %ld not found on "
+           "server\n",
+           parent->i_ino);
+    return -ENOENT;
+  }
+
+  if (http_status == 3) {
+    printk(KERN_ERR
+           "networkfs: request_lookup_path: parent inode %ld is not a "
+           "directory\n",
+           parent->i_ino);
+    return -ENOTDIR;
+  }
+
+  if (http_status != 0) {
+    printk(KERN_ERR
+           "networkfs: request_lookup_path: server returned unknown error "
+           "%lld\n",
+           http_status);
+    return -EIO;
+  }
+
+  if (packed) {
+    return decode_path_info(wire, req.received, result);
+  }
+  if (req.received < sizeof(*result) || result->count > NFS_LOOKUP_PATH_MAX) {
+    return wire_malformed("request_lookup_path");
+  }
   return 0;
 }
 
-int64_t networkfs_request_iterate(const struct file *filp,
-                                  struct networkfs_dir_entries *result) {
+/*
+ * Listing in the packed format is streamed: entries are decoded and passed to
+ * the actor as soon as they arrive, so memory use does not depend on the size
+ * of the page. An entry split between pieces is carried over in @pending,
+ * which fits the largest one.
+ */
+struct list_stream {
+  struct networkfs_http_req req;
+  networkfs_dir_actor_t actor;
+  void *data;
+  bool plus;     // entries carry full attributes
+  bool stopped;  // actor does not take more entries
+  bool counted;  // count is decoded
+  bool ended;    // eof is decoded, nothing may follow
+  bool eof;
+  u64 count;
+  u64 decoded;
+  u8 pending[NFS_WIRE_DIR_ENTRY_MAX];
+  size_t pending_len;
+};
+
+// Decodes complete entries from the start of @pending, returns bytes used
+static size_t list_stream_decode(struct list_stream *stream) {
+  struct wire_cursor cursor = {stream->pending,
+                               stream->pending + stream->pending_len};
+  const u8 *used = cursor.pos;
+
+  while (!stream->ended) {
+    if (!stream->counted) {
+      if (!wire_varint(&cursor, &stream->count)) {
+        break;
+      }
+      stream->counted = true;
+    } else if (stream->decoded < stream->count) {
+      struct networkfs_attr attr;
+      u64 cookie, len;
+      const u8 *name;
+      if (!wire_attr(&cursor, &attr, stream->plus) ||
+          !wire_varint(&cursor, &cookie) || !wire_varint(&cursor, &len) ||
+          len > NFS_NAME_MAX || (name = wire_bytes(&cursor, len)) == NULL) {
+        break;
+      }
+      ++stream->decoded;
+      if (!stream->stopped && !stream->actor(stream->data, (const char *)name,
+                                             len, cookie, &attr)) {
+        stream->stopped = true;
+      }
+    } else {
+      u8 eof;
+      if (!wire_u8(&cursor, &eof)) {
+        break;
+      }
+      stream->eof = eof != 0;
+      stream->ended = true;
+    }
+    used = cursor.pos;
+  }
+  return used - stream->pending;
+}
+
+static int list_stream_consume(struct networkfs_http_req *req,
+                               const void *data, size_t len) {
+  struct list_stream *stream = container_of(req, struct list_stream, req);
+
+  while (len > 0) {
+    size_t copied = min(len, sizeof(stream->pending) - stream->pending_len);
+    memcpy(stream->pending + stream->pending_len, data, copied);
+    stream->pending_len += copied;
+    data += copied;
+    len -= copied;
+
+    size_t used = list_stream_decode(stream);
+    memmove(stream->pending, stream->pending + used,
+            stream->pending_len - used);
+    stream->pending_len -= used;
+    if (stream->pending_len == sizeof(stream->pending) ||
+        (stream->ended && stream->pending_len != 0)) {
+      // not even a single entry fits, or trailing garbage
+      return wire_malformed("request_iterate");
+    }
+  }
+  return 0;
+}
+
+static int64_t request_list(const struct file *filp,
+                            struct networkfs_http_req *req) {
   const struct dentry *dentry = filp->f_path.dentry;
   const struct inode *inode = dentry->d_inode;
-
-  const char *token = inode->i_sb->s_fs_info;
-  ino_to_string(ino_str, inode->i_ino);
-  int64_t http_status = networkfs_http_call(
-      token, "list", (char *)result, sizeof(struct networkfs_dir_entries), 1,
-      "inode", wstr(ino_str));
+  struct networkfs_sb_info *sbi = NFS_SB(inode->i_sb);
+  int64_t http_status = networkfs_rpc_call(sbi, req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -99,14 +411,105 @@ int64_t networkfs_request_iterate(const struct file *filp,
   return 0;
 }
 
+static void encode_list(struct networkfs_http_req *req,
+                        const struct file *filp, bool plus, u64 cookie,
+                        u64 count) {
+  if (plus) {
+    const struct networkfs_listplus_args args = {
+        .inode = filp->f_inode->i_ino, .cookie = cookie, .count = count};
+    networkfs_listplus_encode(req, &args);
+  } else {
+    const struct networkfs_list_args args = {
+        .inode = filp->f_inode->i_ino, .cookie = cookie, .count = count};
+    networkfs_list_encode(req, &args);
+  }
+}
+
+static int64_t request_list_packed(const struct file *filp, bool plus,
+                                   u64 cookie, bool *eof,
+                                   networkfs_dir_actor_t actor, void *data) {
+  struct list_stream stream = {.actor = actor, .data = data, .plus = plus};
+  encode_list(&stream.req, filp, plus, cookie, NFS_DIR_PAGE_MAX);
+  stream.req.consume = list_stream_consume;
+
+  int64_t error = request_list(filp, &stream.req);
+  if (error == 0 && (!stream.ended || stream.pending_len != 0)) {
+    error = wire_malformed("request_iterate");
+  }
+  *eof = stream.eof;
+  return error;
+}
+
+static bool emit_dir_entries(const struct networkfs_dir_entries *dir,
+                             networkfs_dir_actor_t actor, void *data) {
+  for (size_t i = 0; i < dir->entries_count; ++i) {
+    const struct networkfs_dir_entry *entry = &dir->entries[i];
+    const struct networkfs_attr attr = {.entry_type = entry->entry_type,
+                                        .ino = entry->ino};
+    if (entry->entry_type == 0 ||
+        !actor(data, wstr(entry->name), entry->cookie, &attr)) {
+      break;
+    }
+  }
+  return dir->eof;
+}
+
+static bool emit_dir_entries_plus(const struct networkfs_dir_entries_plus *dir,
+                                  networkfs_dir_actor_t actor, void *data) {
+  for (size_t i = 0; i < dir->entries_count; ++i) {
+    const struct networkfs_dir_entry_plus *entry = &dir->entries[i];
+    if (entry->attr.entry_type == 0 ||
+        !actor(data, wstr(entry->name), entry->cookie, &entry->attr)) {
+      break;
+    }
+  }
+  return dir->eof;
+}
+
+int64_t networkfs_request_iterate(const struct file *filp, bool plus,
+                                  u64 cookie, bool *eof,
+                                  networkfs_dir_actor_t actor, void *data) {
+  *eof = false;
+  if (NFS_SB(filp->f_inode->i_sb)->vers == NFS_WIRE_PACKED) {
+    return request_list_packed(filp, plus, cookie, eof, actor, data);
+  }
+
+  // too big for stack allocation
+  size_t size = plus ? sizeof(struct networkfs_dir_entries_plus)
+                     : sizeof(struct networkfs_dir_entries);
+  void *dir = kzalloc(size, GFP_KERNEL);
+  if (dir == NULL) {
+    printk(KERN_ERR "networkfs: iterate: response buf alloc failed\n");
+    return -ENOMEM;
+  }
+
+  struct networkfs_http_req req;
+  encode_list(&req, filp, plus, cookie, NFS_DIR_ENTRIES_MAX);
+  req.response = dir;
+  req.response_size = size;
+  int64_t error = request_list(filp, &req);
+  if (error == 0) {
+    error = check_legacy(&req, size, "request_iterate");
+  }
+
+  if (error == 0 && plus) {
+    *eof = emit_dir_entries_plus(dir, actor, data);
+  } else if (error == 0) {
+    *eof = emit_dir_entries(dir, actor, data);
+  }
+  kfree(dir);
+  return error;
+}
+
 int64_t networkfs_request_unlink(const struct inode *parent,
                                  const struct dentry *child) {
-  const char *token = parent->i_sb->s_fs_info;
+  struct networkfs_sb_info *sbi = NFS_SB(parent->i_sb);
   const char *name = child->d_name.name;
-  ino_to_string(parent_ino_str, parent->i_ino);
-  int64_t http_status =
-      networkfs_http_call(token, "unlink", NULL, 0, 2, "parent",
-                          wstr(parent_ino_str), "name", wstr(name));
+  const struct networkfs_unlink_args args = {.parent = parent->i_ino,
+                                             .name = child->d_name};
+  struct networkfs_http_req req;
+  networkfs_unlink_encode(&req, &args);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -151,12 +554,19 @@ int64_t networkfs_request_unlink(const struct inode *parent,
 int64_t networkfs_request_create_generic(const struct inode *parent,
                                          const struct dentry *child,
                                          const char *type, ino_t *result) {
-  const char *token = parent->i_sb->s_fs_info;
+  struct networkfs_sb_info *sbi = NFS_SB(parent->i_sb);
   const char *name = child->d_name.name;
-  ino_to_string(parent_ino_str, parent->i_ino);
-  int64_t http_status = networkfs_http_call(
-      token, "create", (char *)result, sizeof(ino_t), 3, "parent",
-      wstr(parent_ino_str), "name", wstr(name), "type", wstr(type));
+  bool packed = sbi->vers == NFS_WIRE_PACKED;
+  u8 wire[NFS_WIRE_VARINT_MAX];
+  const struct networkfs_create_args args = {
+      .parent = parent->i_ino,
+      .name = child->d_name,
+      .type = QSTR_INIT(type, strlen(type))};
+  struct networkfs_http_req req;
+  networkfs_create_encode(&req, &args);
+  req.response = packed ? (char *)wire : (char *)result;
+  req.response_size = packed ? sizeof(wire) : sizeof(ino_t);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -200,17 +610,19 @@ int64_t networkfs_request_create_generic(const struct inode *parent,
     return -EIO;
   }
 
-  return 0;
+  return packed ? decode_ino(wire, req.received, result)
+                : check_legacy(&req, sizeof(*result), "request_create_generic");
 }
 
 int64_t networkfs_request_rmdir(const struct inode *parent,
                                 const struct dentry *child) {
-  const char *token = parent->i_sb->s_fs_info;
+  struct networkfs_sb_info *sbi = NFS_SB(parent->i_sb);
   const char *name = child->d_name.name;
-  ino_to_string(parent_ino_str, parent->i_ino);
-  int64_t http_status =
-      networkfs_http_call(token, "rmdir", NULL, 0, 2, "parent",
-                          wstr(parent_ino_str), "name", wstr(name));
+  const struct networkfs_rmdir_args args = {.parent = parent->i_ino,
+                                            .name = child->d_name};
+  struct networkfs_http_req req;
+  networkfs_rmdir_encode(&req, &args);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -254,10 +666,13 @@ int64_t networkfs_request_rmdir(const struct inode *parent,
 int64_t networkfs_request_read(const struct inode *inode,
                                const struct file *filp, void *buffer,
                                size_t buffer_size) {
-  const char *token = inode->i_sb->s_fs_info;
-  ino_to_string(ino_str, inode->i_ino);
-  int64_t http_status = networkfs_http_call(token, "read", buffer, buffer_size,
-                                            1, "inode", wstr(ino_str));
+  struct networkfs_sb_info *sbi = NFS_SB(inode->i_sb);
+  const struct networkfs_read_args args = {.inode = inode->i_ino};
+  struct networkfs_http_req req;
+  networkfs_read_encode(&req, &args);
+  req.response = buffer;
+  req.response_size = buffer_size;
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -281,16 +696,25 @@ int64_t networkfs_request_read(const struct inode *inode,
     return -EIO;
   }
 
+  if (sbi->vers == NFS_WIRE_PACKED) {
+    return decode_content(buffer, buffer_size, req.received);
+  }
+  if (req.received < sizeof(u64) ||
+      *(u64 *)buffer > req.received - sizeof(u64)) {
+    return wire_malformed("request_read");
+  }
   return 0;
 }
 
 int64_t networkfs_request_write(const struct file *filp, size_t size) {
   const char *content = filp->private_data;
-  const char *token = filp->f_inode->i_sb->s_fs_info;
-  ino_to_string(ino_str, filp->f_inode->i_ino);
-  int64_t http_status =
-      networkfs_http_call(token, "write", NULL, 0, 2, "inode", wstr(ino_str),
-                          "content", content, size);
+  struct networkfs_sb_info *sbi = NFS_SB(filp->f_inode->i_sb);
+  const struct networkfs_write_args args = {.inode = filp->f_inode->i_ino};
+  struct networkfs_http_req req;
+  networkfs_write_encode(&req, &args);
+  req.body = content;
+  req.body_size = size;
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -328,13 +752,14 @@ int64_t networkfs_request_write(const struct file *filp, size_t size) {
 
 int64_t networkfs_request_link(struct dentry *target, struct inode *parent,
                                struct dentry *child) {
-  const char *token = target->d_inode->i_sb->s_fs_info;
+  struct networkfs_sb_info *sbi = NFS_SB(target->d_inode->i_sb);
   const char *name = child->d_name.name;
-  ino_to_string(target_ino_str, target->d_inode->i_ino);
-  ino_to_string(par_ino_str, parent->i_ino);
-  int64_t http_status = networkfs_http_call(
-      token, "link", NULL, 0, 3, "source", wstr(target_ino_str), "parent",
-      wstr(par_ino_str), "name", wstr(name));
+  const struct networkfs_link_args args = {.source = target->d_inode->i_ino,
+                                           .parent = parent->i_ino,
+                                           .name = child->d_name};
+  struct networkfs_http_req req;
+  networkfs_link_encode(&req, &args);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
 
   if ((http_status = handle_error(http_status)) < 0) {
     return http_status;
@@ -382,3 +807,288 @@ int64_t networkfs_request_link(struct dentry *target, struct inode *parent,
 
   return 0;
 }
+
+int64_t networkfs_request_getattr(const struct inode *inode,
+                                  struct networkfs_attr *result) {
+  struct networkfs_sb_info *sbi = NFS_SB(inode->i_sb);
+  bool packed = sbi->vers == NFS_WIRE_PACKED;
+  u8 wire[NFS_WIRE_ATTR_MAX];
+  const struct networkfs_getattr_args args = {.inode = inode->i_ino};
+  struct networkfs_http_req req;
+  networkfs_getattr_encode(&req, &args);
+  req.response = packed ? (char *)wire : (char *)result;
+  req.response_size = packed ? sizeof(wire) : sizeof(struct networkfs_attr);
+  int64_t http_status = networkfs_rpc_call(sbi, &req);
+
+  if ((http_status = handle_error(http_status)) < 0) {
+    return http_status;
+  }
+
+  if (http_status == 1) {
+    printk(KERN_ERR
+           "networkfs: request_getattr: inode %ld not found on server\n",
+           inode->i_ino);
+    return -ESTALE;
+  }
+
+  if (http_status != 0) {
+    printk(KERN_ERR
+           "networkfs: request_getattr: server returned unknown error %lld\n",
+           http_status);
+    return -EIO;
+  }
+
+  return packed ? decode_attr(wire, req.received, result)
+                : check_legacy(&req, sizeof(*result), "request_getattr");
+}
+
+enum compound_arg_kind {
+  COMPOUND_ARG_NUMBER,
+  COMPOUND_ARG_STRING,
+  COMPOUND_ARG_RESULT,
+};
+
+// Appends to the body of a compound, a call that does not fit fails it
+static void compound_put(struct networkfs_compound *c, const void *data,
+                         size_t len) {
+  if (c->error < 0) {
+    return;
+  }
+  if (len > sizeof(c->body) - c->body_size) {
+    c->error = -E2BIG;
+    return;
+  }
+  memcpy(c->body + c->body_size, data, len);
+  c->body_size += len;
+}
+
+static void compound_put_varint(struct networkfs_compound *c, u64 value) {
+  u8 wire[NFS_WIRE_VARINT_MAX];
+  size_t len = 0;
+  while (value >= 0x80) {
+    wire[len++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  wire[len++] = value;
+  compound_put(c, wire, len);
+}
+
+static void compound_put_bytes(struct networkfs_compound *c, const void *data,
+                               size_t len) {
+  compound_put_varint(c, len);
+  compound_put(c, data, len);
+}
+
+struct networkfs_compound *networkfs_compound_alloc(
+    struct networkfs_sb_info *sbi) {
+  struct networkfs_compound *c = kmalloc(sizeof(*c), GFP_KERNEL);
+  if (c == NULL) {
+    return NULL;
+  }
+  c->sbi = sbi;
+  c->idempotent = true;
+  c->error = 0;
+  c->count = 0;
+  c->body_size = 0;
+  c->executed = 0;
+  return c;
+}
+
+int networkfs_compound_add(struct networkfs_compound *c,
+                           const struct networkfs_http_req *req) {
+  if (c->error == 0 && c->count == NFS_COMPOUND_MAX) {
+    c->error = -E2BIG;
+  }
+  if (c->error < 0) {
+    return c->error;
+  }
+  if ((req->op->flags & NFS_OP_IDEMPOTENT) == 0) {
+    c->idempotent = false;
+  }
+
+  compound_put_bytes(c, req->op->name, strlen(req->op->name));
+  compound_put_varint(c, req->arg_size);
+  for (size_t i = 0; i < req->arg_size; ++i) {
+    const struct networkfs_http_arg *arg = &req->args[i];
+    // "&key=", the first one goes without the separator
+    size_t skip = arg->key[0] == '&' ? 1 : 0;
+    u8 kind;
+    compound_put_bytes(c, arg->key + skip, arg->key_len - skip - 1);
+    switch (arg->kind) {
+      case NFS_ARG_STR:
+        kind = COMPOUND_ARG_STRING;
+        compound_put(c, &kind, 1);
+        compound_put_bytes(c, arg->value, arg->len);
+        break;
+      case NFS_ARG_REF:
+        if (arg->number >= c->count) {
+          printk(KERN_ERR
+                 "networkfs: compound_add: %s refers to call %llu\n",
+                 req->op->name, arg->number);
+          c->error = -EINVAL;
+        }
+        kind = COMPOUND_ARG_RESULT;
+        compound_put(c, &kind, 1);
+        compound_put_varint(c, arg->number);
+        break;
+      default:
+        kind = COMPOUND_ARG_NUMBER;
+        compound_put(c, &kind, 1);
+        compound_put_varint(c, arg->number);
+        break;
+    }
+  }
+  compound_put_bytes(c, req->body, req->body != NULL ? req->body_size : 0);
+
+  if (c->error < 0) {
+    return c->error;
+  }
+  ++c->count;
+  return 0;
+}
+
+void networkfs_compound_ref(struct networkfs_http_arg *arg, size_t call) {
+  arg->kind = NFS_ARG_REF;
+  arg->number = call;
+}
+
+static int64_t decode_compound(struct networkfs_compound *c, size_t size) {
+  struct wire_cursor cursor = {c->response, c->response + size};
+  u64 count;
+  if (!wire_varint(&cursor, &count) || count == 0 || count > c->count) {
+    return wire_malformed("compound_exec");
+  }
+  for (size_t i = 0; i < count; ++i) {
+    struct networkfs_compound_result *result = &c->results[i];
+    u64 size;
+    if (!wire_varint(&cursor, &result->status) ||
+        !wire_varint(&cursor, &size) ||
+        (result->payload = wire_bytes(&cursor, size)) == NULL) {
+      return wire_malformed("compound_exec");
+    }
+    result->size = size;
+    // execution stops at the first call that fails
+    if (result->status != 0 && i + 1 != count) {
+      return wire_malformed("compound_exec");
+    }
+  }
+  c->executed = count;
+  return 0;
+}
+
+int64_t networkfs_compound_exec(struct networkfs_compound *c) {
+  if (c->error < 0) {
+    return c->error;
+  }
+  if (c->sbi->vers != NFS_WIRE_PACKED) {
+    printk(KERN_ERR "networkfs: compound_exec: needs the packed format\n");
+    return -EOPNOTSUPP;
+  }
+
+  const struct networkfs_compound_args args = {};
+  struct networkfs_http_req req;
+  networkfs_compound_encode(&req, &args);
+  // repeated like its calls would be, none of them may be hedged
+  struct networkfs_op op = *req.op;
+  if (c->idempotent) {
+    op.flags |= NFS_OP_IDEMPOTENT;
+  }
+  req.op = &op;
+  req.body = c->body;
+  req.body_size = c->body_size;
+  req.response = (char *)c->response;
+  req.response_size = sizeof(c->response);
+  int64_t http_status = networkfs_rpc_call(c->sbi, &req);
+
+  if ((http_status = handle_error(http_status)) < 0) {
+    return http_status;
+  }
+
+  int64_t error = decode_compound(c, req.received);
+  return error < 0 ? error : http_status;
+}
+
+// Results of the lookup and the read or the empty write of the entry it finds,
+// which fails if the entry is a directory
+static int64_t decode_open(const struct networkfs_compound *c,
+                           const struct inode *parent, bool trunc,
+                           struct networkfs_entry_info *result, void *buffer,
+                           size_t buffer_size) {
+  const struct networkfs_compound_result *entry = &c->results[0];
+  const struct networkfs_compound_result *content = &c->results[1];
+
+  if (entry->status == 1 || entry->status == 4) {
+    // parent or the entry is missing
+    return -ENOENT;
+  }
+  if (entry->status == 3) {
+    printk(KERN_ERR
+           "networkfs: request_open: parent inode %ld is not a directory\n",
+           parent->i_ino);
+    return -ENOTDIR;
+  }
+  if (entry->status != 0) {
+    printk(KERN_ERR
+           "networkfs: request_open: server returned unknown error %llu\n",
+           entry->status);
+    return -EIO;
+  }
+  int64_t error = decode_entry_info(entry->payload, entry->size, result);
+  if (error < 0) {
+    return error;
+  }
+  if (c->executed != 2) {
+    return wire_malformed("request_open");
+  }
+
+  if (content->status == 2 && result->entry_type == DT_DIR) {
+    return 0;
+  }
+  if (content->status != 0) {
+    printk(KERN_ERR
+           "networkfs: request_open: server returned unknown error %llu\n",
+           content->status);
+    return -EIO;
+  }
+  if (trunc) {
+    *(u64 *)buffer = 0;
+    return 0;
+  }
+  if (content->size > buffer_size) {
+    return wire_malformed("request_open");
+  }
+  memcpy(buffer, content->payload, content->size);
+  return decode_content(buffer, buffer_size, content->size);
+}
+
+int64_t networkfs_request_open(const struct inode *parent,
+                               const struct dentry *child, bool trunc,
+                               struct networkfs_entry_info *result,
+                               void *buffer, size_t buffer_size) {
+  struct networkfs_compound *c =
+      networkfs_compound_alloc(NFS_SB(parent->i_sb));
+  if (c == NULL) {
+    return -ENOMEM;
+  }
+  const struct networkfs_lookup_args lookup = {.parent = parent->i_ino,
+                                               .name = child->d_name};
+  const struct networkfs_read_args read = {0};
+  const struct networkfs_write_args write = {0};
+  struct networkfs_http_req req;
+  networkfs_lookup_encode(&req, &lookup);
+  networkfs_compound_add(c, &req);
+  if (trunc) {
+    networkfs_write_encode(&req, &write);  // without a body
+  } else {
+    networkfs_read_encode(&req, &read);
+  }
+  networkfs_compound_ref(&req.args[0], 0);  // of the ino looked up
+  networkfs_compound_add(c, &req);
+
+  int64_t error = networkfs_compound_exec(c);
+  if (error >= 0) {
+    error = decode_open(c, parent, trunc, result, buffer, buffer_size);
+  }
+  kfree(c);
+  return error;
+}
@@ -0,0 +1,397 @@
+#include "remote/rpc.h"
+
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/minmax.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+
+#include "networkfs.h"
+#include "remote/ops.h"
+
+int networkfs_rpc_init(struct networkfs_sb_info *sbi,
+                       const struct networkfs_mount_options *opts) {
+  sbi->timeout = opts->timeo * HZ / 10;
+  sbi->retrans = opts->retrans;
+  sbi->hedge = opts->hedge;
+  sbi->compress = opts->compress;
+  sbi->vers = opts->vers;
+  spin_lock_init(&sbi->read_latency.lock);
+  init_waitqueue_head(&sbi->hedge_wait);
+
+  struct networkfs_sock_opts sock_opts = opts->sock_opts;
+  sock_opts.timeout = sbi->timeout;
+  int error = networkfs_pool_init(&sbi->pool, &opts->endpoint, &sock_opts,
+                                  opts->pool_size, opts->pipeline);
+  if (error != 0) {
+    return error;
+  }
+
+  // More workers than requests the pool can carry would only wait for
+  // connections, and the workqueue takes at most WQ_MAX_ACTIVE anyway. With
+  // rx_cpu, asynchronous calls run on that CPU.
+  sbi->rx_cpu = opts->rx_cpu;
+  size_t max_active = opts->pool_size * opts->pipeline;
+  sbi->wq = alloc_workqueue(
+      "networkfs_rpc", (sbi->rx_cpu < 0 ? WQ_UNBOUND : 0) | WQ_MEM_RECLAIM,
+      min_t(size_t, max_active, WQ_MAX_ACTIVE));
+  return sbi->wq != NULL ? 0 : -ENOMEM;
+}
+
+void networkfs_rpc_destroy(struct networkfs_sb_info *sbi) {
+  if (sbi->wq != NULL) {
+    // waits for the calls in flight
+    destroy_workqueue(sbi->wq);
+    sbi->wq = NULL;
+  }
+  networkfs_pool_destroy(&sbi->pool);
+}
+
+// Latency histogram
+
+static void latency_record(struct networkfs_latency *latency, s64 us) {
+  unsigned int bucket =
+      us > 0 ? min_t(unsigned int, ilog2(us) + 1, NFS_LATENCY_BUCKETS - 1)
+             : 0;
+
+  spin_lock(&latency->lock);
+  if (latency->total == NFS_LATENCY_WINDOW) {
+    // Age old samples, so the percentile follows the server
+    latency->total = 0;
+    for (size_t i = 0; i < NFS_LATENCY_BUCKETS; ++i) {
+      latency->buckets[i] /= 2;
+      latency->total += latency->buckets[i];
+    }
+  }
+  ++latency->buckets[bucket];
+  ++latency->total;
+  spin_unlock(&latency->lock);
+}
+
+// Upper bound of the 95th percentile in microseconds, 0 if unknown yet
+static u64 latency_p95(struct networkfs_latency *latency) {
+  u64 p95 = 0;
+
+  spin_lock(&latency->lock);
+  if (latency->total >= NFS_LATENCY_MIN_SAMPLES) {
+    u32 threshold = latency->total - latency->total / 20;
+    u32 seen = 0;
+    for (size_t i = 0; i < NFS_LATENCY_BUCKETS; ++i) {
+      seen += latency->buckets[i];
+      if (seen >= threshold) {
+        p95 = 1ull << i;
+        break;
+      }
+    }
+  }
+  spin_unlock(&latency->lock);
+
+  return p95;
+}
+
+static int64_t rpc_send(struct networkfs_sb_info *sbi,
+                        struct networkfs_http_req *req) {
+  ktime_t start = ktime_get();
+  int64_t result = networkfs_http_exec(&sbi->pool, sbi->token, req);
+  if (sbi->hedge && result >= 0 && (req->op->flags & NFS_OP_HEDGED) != 0) {
+    latency_record(&sbi->read_latency, ktime_us_delta(ktime_get(), start));
+  }
+  return result;
+}
+
+static bool rpc_should_retry(const struct networkfs_http_req *req,
+                             int64_t result) {
+  if (req->consumed != 0) {
+    // the consumer can not take the payload twice
+    return false;
+  }
+  switch (-result) {
+    case ESOCKNOCREATE:
+    case ESOCKNOCONNECT:
+      // nothing has reached the server
+      return true;
+    case ESOCKNOMSGSEND:
+    case ESOCKNOMSGRECV:
+    case ESOCKTIMEOUT:
+      return (req->op->flags & NFS_OP_IDEMPOTENT) != 0;
+    default:
+      return false;
+  }
+}
+
+// Every attempt is bounded by the socket timeout, failed attempts are
+// repeated up to sbi->retrans times with exponential backoff
+static int64_t rpc_exec(struct networkfs_sb_info *sbi,
+                        struct networkfs_http_req *req) {
+  unsigned long backoff = NFS_RETRY_BACKOFF;
+  int64_t result;
+
+  for (unsigned int attempt = 0;; ++attempt) {
+    result = rpc_send(sbi, req);
+    if (attempt == sbi->retrans || !rpc_should_retry(req, result)) {
+      break;
+    }
+    if (msleep_interruptible(jiffies_to_msecs(backoff)) != 0) {
+      break;
+    }
+    backoff = min(2 * backoff, sbi->timeout);
+  }
+
+  return result;
+}
+
+// Call descriptors
+
+static bool rpc_may_send(struct networkfs_http_req *req) {
+  struct networkfs_rpc *rpc = container_of(req, struct networkfs_rpc, req);
+
+  spin_lock(&rpc->lock);
+  bool send = !rpc->cancelled;
+  if (send) {
+    rpc->state = NFS_RPC_SENT;
+  }
+  spin_unlock(&rpc->lock);
+  return send;
+}
+
+static void rpc_complete(struct networkfs_rpc *rpc, int64_t result) {
+  spin_lock(&rpc->lock);
+  rpc->state = NFS_RPC_DONE;
+  rpc->result = result;
+  spin_unlock(&rpc->lock);
+
+  if (rpc->callback != NULL) {
+    rpc->callback(rpc);
+  }
+  complete_all(&rpc->done);
+}
+
+static void rpc_work(struct work_struct *work) {
+  struct networkfs_rpc *rpc = container_of(work, struct networkfs_rpc, work);
+
+  rpc_complete(rpc, READ_ONCE(rpc->cancelled)
+                        ? -ECANCELED
+                        : rpc_exec(rpc->sbi, &rpc->req));
+  // reference taken by networkfs_rpc_submit()
+  networkfs_rpc_put(rpc);
+}
+
+static struct networkfs_rpc *rpc_alloc(struct networkfs_sb_info *sbi,
+                                       const struct networkfs_http_req *req) {
+  struct networkfs_rpc *rpc =
+      kzalloc(sizeof(struct networkfs_rpc), GFP_KERNEL);
+  if (rpc == NULL) {
+    return NULL;
+  }
+  rpc->req = *req;
+
+  // Strings usually live on the submitter's stack, keep them in one block
+  size_t values_size = 0;
+  for (size_t i = 0; i < req->arg_size && i < NFS_HTTP_MAX_ARGS; ++i) {
+    if (req->args[i].kind == NFS_ARG_STR) {
+      values_size += req->args[i].len;
+    }
+  }
+  rpc->values = kmalloc(values_size + 1, GFP_KERNEL);
+  if (rpc->values == NULL) {
+    kfree(rpc);
+    return NULL;
+  }
+  char *value = rpc->values;
+  for (size_t i = 0; i < req->arg_size && i < NFS_HTTP_MAX_ARGS; ++i) {
+    if (req->args[i].kind != NFS_ARG_STR) {
+      continue;
+    }
+    memcpy(value, req->args[i].value, req->args[i].len);
+    rpc->req.args[i].value = value;
+    value += req->args[i].len;
+  }
+
+  kref_init(&rpc->ref);
+  INIT_WORK(&rpc->work, rpc_work);
+  init_completion(&rpc->done);
+  spin_lock_init(&rpc->lock);
+  rpc->sbi = sbi;
+  rpc->req.may_send = rpc_may_send;
+  rpc->state = NFS_RPC_QUEUED;
+  return rpc;
+}
+
+// Options of the mount that apply to every call
+static void rpc_prepare(struct networkfs_sb_info *sbi,
+                        struct networkfs_http_req *req) {
+  req->compress = sbi->compress;
+  req->version = sbi->vers;
+}
+
+struct networkfs_rpc *networkfs_rpc_alloc(
+    struct networkfs_sb_info *sbi, const struct networkfs_http_req *req) {
+  struct networkfs_rpc *rpc = rpc_alloc(sbi, req);
+  if (rpc != NULL) {
+    rpc_prepare(sbi, &rpc->req);
+  }
+  return rpc;
+}
+
+void networkfs_rpc_get(struct networkfs_rpc *rpc) { kref_get(&rpc->ref); }
+
+static void rpc_release(struct kref *ref) {
+  struct networkfs_rpc *rpc = container_of(ref, struct networkfs_rpc, ref);
+  kfree(rpc->buffer);
+  kfree(rpc->values);
+  kfree(rpc);
+}
+
+void networkfs_rpc_put(struct networkfs_rpc *rpc) {
+  kref_put(&rpc->ref, rpc_release);
+}
+
+void networkfs_rpc_submit(struct networkfs_rpc *rpc,
+                          networkfs_rpc_done_t callback, void *data) {
+  rpc->callback = callback;
+  rpc->data = data;
+
+  networkfs_rpc_get(rpc);
+  // the CPU may have gone offline since mount
+  if (rpc->sbi->rx_cpu >= 0 && cpu_online(rpc->sbi->rx_cpu)) {
+    queue_work_on(rpc->sbi->rx_cpu, rpc->sbi->wq, &rpc->work);
+  } else {
+    queue_work(rpc->sbi->wq, &rpc->work);
+  }
+}
+
+bool networkfs_rpc_cancel(struct networkfs_rpc *rpc) {
+  spin_lock(&rpc->lock);
+  bool cancel = rpc->state == NFS_RPC_QUEUED;
+  if (cancel) {
+    rpc->cancelled = true;
+  }
+  spin_unlock(&rpc->lock);
+
+  if (cancel && cancel_work(&rpc->work)) {
+    // Work has not started, so it completes here. Otherwise the worker sees
+    // the flag before sending and completes with the same result.
+    rpc_complete(rpc, -ECANCELED);
+    networkfs_rpc_put(rpc);
+  }
+  return cancel;
+}
+
+bool networkfs_rpc_done(struct networkfs_rpc *rpc) {
+  spin_lock(&rpc->lock);
+  bool done = rpc->state == NFS_RPC_DONE;
+  spin_unlock(&rpc->lock);
+  return done;
+}
+
+int64_t networkfs_rpc_wait(struct networkfs_rpc *rpc) {
+  if (wait_for_completion_interruptible(&rpc->done) == 0) {
+    return rpc->result;
+  }
+
+  if (networkfs_rpc_cancel(rpc)) {
+    return -EINTR;
+  }
+  // The response has to be consumed, the wait is bounded by socket timeout
+  wait_for_completion(&rpc->done);
+  return rpc->result;
+}
+
+// Hedged calls
+
+static void hedge_wake(struct networkfs_rpc *rpc) {
+  wake_up_all(&rpc->sbi->hedge_wait);
+}
+
+// Copy of the call with its own response buffer, so the loser of the race
+// can finish after the caller has returned
+static struct networkfs_rpc *hedge_submit(struct networkfs_sb_info *sbi,
+                                          struct networkfs_http_req *req) {
+  struct networkfs_rpc *rpc = rpc_alloc(sbi, req);
+  if (rpc == NULL) {
+    return NULL;
+  }
+  rpc->buffer = kmalloc(req->response_size, GFP_KERNEL);
+  if (rpc->buffer == NULL && req->response_size != 0) {
+    networkfs_rpc_put(rpc);
+    return NULL;
+  }
+  rpc->req.response = rpc->buffer;
+
+  networkfs_rpc_submit(rpc, hedge_wake, NULL);
+  return rpc;
+}
+
+// First call answered by the server, or a failed one once all are done
+static struct networkfs_rpc *hedge_winner(struct networkfs_rpc **calls) {
+  struct networkfs_rpc *failed = NULL;
+  bool pending = false;
+
+  for (size_t i = 0; i < 2 && calls[i] != NULL; ++i) {
+    if (!networkfs_rpc_done(calls[i])) {
+      pending = true;
+    } else if (calls[i]->result >= 0) {
+      return calls[i];
+    } else if (failed == NULL) {
+      failed = calls[i];
+    }
+  }
+  return pending ? NULL : failed;
+}
+
+/*
+ * The call is sent to the workqueue, and if it is not answered within the
+ * 95th percentile of latency, an identical one is sent too. Whichever is
+ * answered first wins, the other one is cancelled if it is not sent yet.
+ */
+static int64_t rpc_exec_hedged(struct networkfs_sb_info *sbi,
+                               struct networkfs_http_req *req) {
+  u64 p95 = latency_p95(&sbi->read_latency);
+  if (p95 == 0) {
+    return rpc_exec(sbi, req);
+  }
+
+  struct networkfs_rpc *calls[2] = {hedge_submit(sbi, req), NULL};
+  if (calls[0] == NULL) {
+    return -ENOMEM;
+  }
+
+  int64_t result = -EINTR;
+  int error = wait_event_interruptible_hrtimeout(
+      sbi->hedge_wait, networkfs_rpc_done(calls[0]),
+      ns_to_ktime(p95 * NSEC_PER_USEC));
+  if (error == -ETIME) {
+    calls[1] = hedge_submit(sbi, req);
+    error = wait_event_interruptible(sbi->hedge_wait,
+                                     hedge_winner(calls) != NULL);
+  }
+
+  if (error == 0) {
+    struct networkfs_rpc *winner = hedge_winner(calls);
+    result = winner->result;
+    if (result >= 0) {
+      req->received = winner->req.received;
+      memcpy(req->response, winner->buffer, req->received);
+    }
+  }
+
+  for (size_t i = 0; i < 2 && calls[i] != NULL; ++i) {
+    networkfs_rpc_cancel(calls[i]);
+    networkfs_rpc_put(calls[i]);
+  }
+  return result;
+}
+
+int64_t networkfs_rpc_call(struct networkfs_sb_info *sbi,
+                           struct networkfs_http_req *req) {
+  rpc_prepare(sbi, req);
+
+  if (sbi->hedge && (req->op->flags & NFS_OP_HEDGED) != 0) {
+    return rpc_exec_hedged(sbi, req);
+  }
+  // Nothing to overlap with, so the call does not bounce through the
+  // workqueue. Arguments are referenced, the caller outlives the call.
+  return rpc_exec(sbi, req);
+}
@@ -0,0 +1,75 @@
+#include "remote/urlencode.h"
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+typedef uint64_t u64;
+#endif
+
+static const unsigned char URLENCODE_SAFE[256] = {
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1};
+
+#define HEX_ROW(h)                                                    \
+  "%" #h "0%" #h "1%" #h "2%" #h "3%" #h "4%" #h "5%" #h "6%" #h "7" \
+  "%" #h "8%" #h "9%" #h "A%" #h "B%" #h "C%" #h "D%" #h "E%" #h "F"
+
+// "%XX" for every byte value, 3 bytes per entry
+static const char URLENCODE_ESCAPES[] =
+    HEX_ROW(0) HEX_ROW(1) HEX_ROW(2) HEX_ROW(3) HEX_ROW(4) HEX_ROW(5)
+        HEX_ROW(6) HEX_ROW(7) HEX_ROW(8) HEX_ROW(9) HEX_ROW(A) HEX_ROW(B)
+            HEX_ROW(C) HEX_ROW(D) HEX_ROW(E) HEX_ROW(F);
+
+#define BYTES_ONES 0x0101010101010101ULL
+#define BYTES_HIGHS 0x8080808080808080ULL
+
+// Sets the high bit of every byte b of x such that m < b < n, exact for
+// 0 <= m <= 127 and 0 <= n <= 128 (see "Determine if a word has a byte
+// between m and n" in Bit Twiddling Hacks).
+#define BYTES_BETWEEN(x, m, n)                                    \
+  ((((BYTES_ONES * (127 + (n))) - ((x) & BYTES_ONES * 127)) & ~(x) & \
+    (((x) & BYTES_ONES * 127) + BYTES_ONES * (127 - (m)))) &        \
+   BYTES_HIGHS)
+
+static inline bool word_is_safe(u64 word) {
+  u64 safe = BYTES_BETWEEN(word, '0' - 1, '9' + 1) |
+             BYTES_BETWEEN(word, 'A' - 1, 'Z' + 1) |
+             BYTES_BETWEEN(word, 'a' - 1, 'z' + 1);
+  return safe == BYTES_HIGHS;
+}
+
+static inline char *encode_byte(char *dst, unsigned char c) {
+  if (URLENCODE_SAFE[c]) {
+    *dst = c;
+    return dst + 1;
+  }
+  memcpy(dst, URLENCODE_ESCAPES + 3 * c, 3);
+  return dst + 3;
+}
+
+size_t networkfs_urlencode(char *dst, const char *src, size_t len) {
+  char *out = dst;
+  size_t idx = 0;
+
+  while (idx + sizeof(u64) <= len) {
+    u64 word;
+    memcpy(&word, src + idx, sizeof(u64));
+    if (word_is_safe(word)) {
+      memcpy(out, &word, sizeof(u64));
+      out += sizeof(u64);
+      idx += sizeof(u64);
+      continue;
+    }
+    for (size_t end = idx + sizeof(u64); idx < end; ++idx) {
+      out = encode_byte(out, src[idx]);
+    }
+  }
+  for (; idx < len; ++idx) {
+    out = encode_byte(out, src[idx]);
+  }
+
+  *out = 0;
+  return out - dst;
+}
@@ -1,5 +1,11 @@
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -52,6 +58,61 @@ TEST_F(BaseTest, ListNested) {
   ASSERT_EQ(actual_files, expected_files);
 }
 
+TEST_F(BaseTest, ListThenStat) {
+  remount("rdirplus,acregmin=30,acdirmin=30");
+  nfs.create(ROOT_INO, "dir", EntryType::DIRECTORY);
+
+  // entries are cached with their attributes by the listing itself, so they
+  // are not asked for again while the cache is valid, even if removed
+  std::set<std::string> expected_files{"dir", "file1", "file2"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+  nfs.unlink(ROOT_INO, "file1");
+  nfs.unlink(ROOT_INO, "file2");
+  nfs.rmdir(ROOT_INO, "dir");
+  ASSERT_TRUE(fs::is_directory({"dir"}));
+  ASSERT_EQ(fs::file_size({"file1"}), 22);
+  ASSERT_EQ(fs::hard_link_count({"file2"}), 1);
+}
+
+TEST_F(BaseTest, ListAfterChanges) {
+  std::set<std::string> expected_files{"file1", "file2"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+
+  // the cached listing is dropped by our own calls
+  fs::create_directory({"dir"});
+  std::fstream({"file3"}, std::ios::out).close();
+  fs::remove({"file1"});
+  expected_files = {"dir", "file2", "file3"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+}
+
+TEST_F(BaseTest, DeepPath) {
+  // every name is trusted for a second after it is checked
+  remount("actimeo=1");
+  ino_t parent = ROOT_INO;
+  std::string path;
+  for (const char* name: {"a", "b", "c", "d", "e"}) {
+    parent = nfs.create(parent, name, EntryType::DIRECTORY).ino;
+    path += std::string(name) + "/";
+  }
+  nfs.create(parent, "file", EntryType::FILE);
+  nfs.create(parent, "other", EntryType::FILE);
+
+  ASSERT_TRUE(fs::is_regular_file({path + "file"}));
+  ASSERT_TRUE(fs::is_regular_file({path + "other"}));
+  fs::current_path({path});
+
+  // names above the working directory expire along with the ones in it, the
+  // whole chain is then checked by a single lookup_path call, which sees the
+  // replaced name
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  nfs.unlink(parent, "other");
+  nfs.create(parent, "other", EntryType::DIRECTORY);
+  ASSERT_TRUE(fs::is_directory({"other"}));
+  ASSERT_TRUE(fs::is_regular_file({"file"}));
+  ASSERT_FALSE(fs::exists({"missing"}));
+}
+
 TEST_F(BaseTest, FileTypes) {
   nfs.create(ROOT_INO, "dir", EntryType::DIRECTORY);
   
@@ -64,6 +125,19 @@ TEST_F(BaseTest, NotFound) {
   ASSERT_FALSE(fs::exists({"abcde"}));
 }
 
+TEST_F(BaseTest, RemovedByServer) {
+  remount("acregmin=1,acregmax=1");
+  ASSERT_TRUE(fs::exists({"file1"}));
+  nfs.unlink(ROOT_INO, "file1");
+
+  // the name is trusted for acregmin, then rechecked
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (fs::exists({"file1"}) && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  ASSERT_FALSE(fs::exists({"file1"}));
+}
+
 TEST_F(BaseTest, CreateFile) {
   std::fstream fs;
 
@@ -77,6 +151,21 @@ TEST_F(BaseTest, CreateFile) {
   ASSERT_EQ(response.entry_type, EntryType::FILE);
 }
 
+TEST_F(BaseTest, CreateAfterNotFound) {
+  // names cached as missing are taken over by our own create and mkdir
+  ASSERT_FALSE(fs::exists({"test"}));
+  ASSERT_FALSE(fs::exists({"directory"}));
+
+  std::fstream fs;
+  fs.open("test", std::ios::out);
+  ASSERT_FALSE(fs.fail());
+  fs.close();
+  ASSERT_NO_THROW(fs::create_directory("directory"));
+
+  ASSERT_TRUE(fs::is_regular_file({"test"}));
+  ASSERT_TRUE(fs::is_directory({"directory"}));
+}
+
 TEST_F(BaseTest, CreateDirectories) {
   ASSERT_NO_THROW(fs::create_directory("test"));
   
@@ -93,11 +182,12 @@ TEST_F(BaseTest, CreateDirectories) {
   ASSERT_EQ(response_nested.entry_type, EntryType::DIRECTORY);
 }
 
-TEST_F(BaseTest, TooManyFiles) {
+TEST_F(BaseTest, ListLarge) {
   nfs.clear();
 
+  // several pages of a listing in either wire format
   std::set<std::string> expected_files;
-  for (int i = 0; i < 16; i++) {
+  for (int i = 0; i < 300; i++) {
     expected_files.insert("test" + std::to_string(i));
   }
 
@@ -107,15 +197,68 @@ TEST_F(BaseTest, TooManyFiles) {
     }
   });
 
-  ASSERT_THROW(
-    fs::create_directory("test17"),
-    fs::filesystem_error
-  );
-
   std::set<std::string> actual_files = list_directory({"."});
   ASSERT_EQ(actual_files, expected_files);
 }
 
+TEST_F(BaseTest, ListChunked) {
+  nfs.clear();
+
+  // long names make a page span many chunks of the response (1 KiB each by
+  // default, see --chunk-size of the server)
+  std::set<std::string> expected_files;
+  for (int i = 0; i < 100; i++) {
+    std::string name = std::to_string(i) + std::string(200, 'a');
+    nfs.create(ROOT_INO, name, EntryType::FILE);
+    expected_files.insert(name);
+  }
+
+  std::vector<std::string> listed;
+  for (const auto& entry: fs::directory_iterator(".")) {
+    listed.push_back(entry.path().filename());
+  }
+  std::set<std::string> actual_files(listed.begin(), listed.end());
+  ASSERT_EQ(listed.size(), actual_files.size());
+  ASSERT_EQ(actual_files, expected_files);
+}
+
+TEST_F(BaseTest, ListWhileRemoving) {
+  nfs.clear();
+
+  // more than a page of either wire format
+  std::set<std::string> expected_files;
+  for (int i = 0; i < 300; i++) {
+    std::string name = "test" + std::to_string(i);
+    nfs.create(ROOT_INO, name, EntryType::FILE);
+    expected_files.insert(name);
+  }
+
+  // entries are resumed after by cookie, so removing listed ones skips nothing;
+  // the small buffer makes every getdents call return a few of them only
+  int fd = open(".", O_RDONLY | O_DIRECTORY);
+  ASSERT_GE(fd, 0);
+  std::vector<std::string> listed;
+  char buffer[512];
+  ssize_t size;
+  while ((size = getdents64(fd, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t pos = 0; pos < size;) {
+      auto* entry = reinterpret_cast<struct dirent64*>(buffer + pos);
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        listed.push_back(name);
+        nfs.unlink(ROOT_INO, name);
+      }
+      pos += entry->d_reclen;
+    }
+  }
+  close(fd);
+  ASSERT_EQ(size, 0);
+
+  std::set<std::string> actual_files(listed.begin(), listed.end());
+  ASSERT_EQ(listed.size(), actual_files.size());
+  ASSERT_EQ(actual_files, expected_files);
+}
+
 TEST_F(BaseTest, LongName) {
   std::fstream fs;
   std::string name(255, 'a');
@@ -1,3 +1,4 @@
+#include <cerrno>
 #include <filesystem>
 #include <fcntl.h>
 #include <fstream>
@@ -28,6 +29,110 @@ TEST_F(FileTest, Read) {
   fs.close();
 }
 
+TEST_F(FileTest, StatWithoutOpen) {
+  // size and times come from getattr, the content is not fetched
+  struct stat st;
+  ASSERT_EQ(stat("file1", &st), 0);
+  ASSERT_EQ(st.st_size, 22);
+  ASSERT_NE(st.st_mtime, 0);
+}
+
+TEST_F(FileTest, OpenUncached) {
+  // lookup and read go in one call for names not looked up yet
+  nfs.clear();
+  ino_t dir = nfs.create(ROOT_INO, "dir", EntryType::DIRECTORY).ino;
+  ino_t file = nfs.create(dir, "file", EntryType::FILE).ino;
+  nfs.write(file, "content");
+
+  int fd = open("dir/file", O_RDONLY);
+  ASSERT_GE(fd, 0);
+  char buffer[16];
+  ASSERT_EQ(read(fd, buffer, sizeof(buffer)), 7);
+  ASSERT_EQ(std::string(buffer, 7), "content");
+  close(fd);
+
+  fd = open("dir", O_RDONLY | O_DIRECTORY);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  ASSERT_EQ(open("missing", O_RDONLY), -1);
+  ASSERT_EQ(errno, ENOENT);
+}
+
+TEST_F(FileTest, OpenExclusive) {
+  ASSERT_EQ(open("file1", O_WRONLY | O_CREAT | O_EXCL, 0644), -1);
+  ASSERT_EQ(errno, EEXIST);
+
+  int fd = open("file", O_RDWR | O_CREAT | O_EXCL, 0644);
+  ASSERT_GE(fd, 0);
+  char buffer[16];
+  ASSERT_EQ(read(fd, buffer, sizeof(buffer)), 0);
+  close(fd);
+  ASSERT_EQ(nfs.lookup(ROOT_INO, "file").status, 0);
+}
+
+TEST_F(FileTest, OpenWithoutRead) {
+  // O_PATH is not prefetched, O_TRUNC empties the file instead of reading it
+  int fd = open("file1", O_PATH);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  nfs.clear();
+  ino_t ino = nfs.create(ROOT_INO, "file", EntryType::FILE).ino;
+  nfs.write(ino, "old content");
+  fd = open("file", O_WRONLY | O_TRUNC);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, "new", 3), 3);
+  close(fd);
+
+  read_response file = nfs.read(ino);
+  ASSERT_EQ(std::string(file.content, file.content_length), "new");
+}
+
+TEST_F(FileTest, OpenTruncating) {
+  // the file is emptied on the server at open, not at the write back
+  ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
+  int fd = open("file1", O_WRONLY | O_TRUNC);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(nfs.read(ino).content_length, 0);
+  struct stat st;
+  ASSERT_EQ(fstat(fd, &st), 0);
+  ASSERT_EQ(st.st_size, 0);
+
+  ASSERT_EQ(write(fd, "new", 3), 3);
+  close(fd);
+  read_response file = nfs.read(ino);
+  ASSERT_EQ(std::string(file.content, file.content_length), "new");
+}
+
+TEST_F(FileTest, ReadAfterGrownOnServer) {
+  // a getattr may grow the size past the content read at open
+  remount("actimeo=0");
+  int fd = open("file1", O_RDONLY);
+  ASSERT_GE(fd, 0);
+  nfs.write(nfs.lookup(ROOT_INO, "file1").ino, std::string(100, 'b'));
+  struct stat st;
+  ASSERT_EQ(stat("file1", &st), 0);
+
+  char buffer[128];
+  ASSERT_EQ(read(fd, buffer, sizeof(buffer)), 22);
+  ASSERT_EQ(std::string(buffer, 22), "hello world from file1");
+  ASSERT_EQ(read(fd, buffer, sizeof(buffer)), 0);
+  close(fd);
+}
+
+TEST_F(FileTest, SizeKeptWhileOpen) {
+  // neither getattr nor a listing changes the size of an open file
+  remount("actimeo=0,rdirplus");
+  int fd = open("file1", O_RDONLY);
+  ASSERT_GE(fd, 0);
+  nfs.write(nfs.lookup(ROOT_INO, "file1").ino, std::string(100, 'b'));
+  list_directory({"."});
+  struct stat st;
+  ASSERT_EQ(stat("file1", &st), 0);
+  ASSERT_EQ(st.st_size, 22);
+  close(fd);
+}
+
 TEST_F(FileTest, ReadLong) {
   nfs.clear();
   ino_t file = nfs.create(ROOT_INO, "file", EntryType::FILE).ino;
@@ -300,6 +405,31 @@ TEST_F(FileTest, WriteSpecial) {
   ASSERT_EQ(actual_content, content);
 }
 
+TEST_F(FileTest, WriteBinary) {
+  nfs.clear();
+
+  std::string content;
+  for (int i = 0; i < 512; i++) {
+    content.push_back((char)(i % 256));
+  }
+
+  std::fstream fs;
+  fs.open("file", std::ios::out | std::ios::binary);
+  ASSERT_FALSE(fs.fail());
+
+  fs.write(content.c_str(), content.size());
+  fs.close();
+  ASSERT_FALSE(fs.fail());
+
+  lookup_response response = nfs.lookup(ROOT_INO, "file");
+  ASSERT_EQ(response.status, 0);
+  ASSERT_EQ(response.entry_type, EntryType::FILE);
+
+  read_response file = nfs.read(response.ino);
+  std::string actual_content = std::string(file.content, file.content + file.content_length);
+  ASSERT_EQ(actual_content, content);
+}
+
 TEST_F(FileTest, WriteLong) {
   nfs.clear();
 
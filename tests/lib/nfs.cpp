@@ -13,8 +13,19 @@ NfsBucket::NfsBucket() : client("localhost", 8080) {}
 void NfsBucket::initialize() {
   auto response = issue();
   this->token_ = std::string(response.token, response.token + sizeof(response.token));
+  mount();
+}
 
-  if (mount(this->token_.data(), TEST_ROOT.c_str(), "networkfs", 0, "")) {
+void NfsBucket::mount(const std::string& extra_options) {
+  // e.g. NETWORKFS_MOUNT_OPTIONS=unix=/tmp/networkfs.sock runs the suite over
+  // a Unix domain socket
+  const char* env_options = getenv("NETWORKFS_MOUNT_OPTIONS");
+  std::string options = env_options ? env_options : "";
+  if (!options.empty() && !extra_options.empty()) {
+    options += ",";
+  }
+  options += extra_options;
+  if (::mount(this->token_.data(), TEST_ROOT.c_str(), "networkfs", 0, options.c_str())) {
     throw std::runtime_error(std::string("Filesystem can not be mounted: ") + strerror(errno));
   }
 
@@ -66,6 +77,9 @@ void NfsBucket::clear(ino_t ino) {
       }
     }
   }
+
+  // the listed page is removed, the next one is the first page again
+  if (!response.eof) clear(ino);
 }
 
 std::string NfsBucket::call_api(const std::string& uri, const httplib::Params& params, size_t attempts) {
@@ -19,9 +19,11 @@ struct token_response {
 struct list_response {
   uint64_t status;
   size_t entries_count;
+  bool eof;
   struct entry {
     EntryType entry_type;
     ino_t ino;
+    uint64_t cookie;
     char name[256];
   } entries[16];
 };
@@ -66,6 +68,7 @@ public:
   const std::string token() const;
 
   void initialize();
+  void mount(const std::string& extra_options = ""); /* Appended to NETWORKFS_MOUNT_OPTIONS */
   void unmount(bool);
 
   ~NfsBucket();
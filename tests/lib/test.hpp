@@ -29,6 +29,14 @@ protected:
     fs::current_path(previous_path);
     nfs.unmount(true);
   }
+
+  // Mounts the bucket again with options of the test, e.g. "actimeo=0"
+  void remount(const std::string& options) {
+    fs::current_path(previous_path);
+    nfs.unmount(true);
+    nfs.mount(options);
+    fs::current_path(TEST_ROOT);
+  }
 };
 
 #endif
@@ -1,4 +1,6 @@
+#include <fcntl.h>
 #include <filesystem>
+#include <fstream>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -36,6 +38,19 @@ TEST_F(LinkTest, Create) {
     ASSERT_EQ(new_ino, original_ino);
 }
 
+TEST_F(LinkTest, CreateAfterNotFound) {
+    ASSERT_FALSE(fs::exists({"file3"}));
+    ASSERT_NO_THROW(fs::create_hard_link({"file2"}, {"file3"}));
+
+    struct stat st;
+    ASSERT_EQ(stat("file3", &st), 0);
+    ASSERT_EQ(st.st_ino, nfs.lookup(ROOT_INO, "file2").ino);
+    ASSERT_EQ(st.st_nlink, 2);
+
+    ASSERT_NO_THROW(fs::remove({"file3"}));
+    ASSERT_FALSE(fs::exists({"file3"}));
+}
+
 TEST_F(LinkTest, Unlink) {
     ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
     nfs.link(ino, ROOT_INO, "file3");
@@ -65,3 +80,39 @@ TEST_F(LinkTest, OtherDirectory) {
     ASSERT_EQ(response.status, 0);
     ASSERT_EQ(response.ino, file);
 }
+
+TEST_F(LinkTest, SharedInode) {
+    ino_t ino = nfs.lookup(ROOT_INO, "file2").ino;
+    nfs.link(ino, ROOT_INO, "file3");
+
+    struct stat st;
+    ASSERT_EQ(stat("file2", &st), 0);
+    ASSERT_EQ(st.st_size, 0);
+
+    std::ofstream out("file3");
+    out << "shared";
+    out.close();
+    ASSERT_FALSE(out.fail());
+
+    // both names refer to one cached inode, so the new size is seen at once
+    ASSERT_EQ(stat("file2", &st), 0);
+    ASSERT_EQ(st.st_size, 6);
+}
+
+TEST_F(LinkTest, ContentPerOpenFile) {
+    ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
+    nfs.link(ino, ROOT_INO, "file3");
+
+    // the inode is shared, but every open file holds the content it read
+    int fd = open("file1", O_RDONLY);
+    ASSERT_GE(fd, 0);
+    std::ofstream out("file3");
+    out << std::string(100, 'b');
+    out.close();
+    ASSERT_FALSE(out.fail());
+
+    char buffer[128];
+    ASSERT_EQ(read(fd, buffer, sizeof(buffer)), 22);
+    ASSERT_EQ(std::string(buffer, 22), "hello world from file1");
+    close(fd);
+}